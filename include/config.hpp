@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "loader.hpp"
+
+namespace modloader {
+
+using namespace std::literals::string_view_literals;
+/// @brief Name of the optional config file, looked up in the root load path
+constexpr static std::string_view kConfigName = "loader.cfg"sv;
+/// @brief Appended to the file name of an object to get the name of its policy file
+constexpr static std::string_view kPolicySuffix = ".policy"sv;
+
+/// @brief Optional loader behaviors. Every option defaults to the behavior of a modloader without a config file.
+/// The config file holds one `key=value` pair per line, lines starting with # are ignored.
+struct LoaderConfig {
+  /// @brief memfd_staging: stage every object into a sealed memfd and dlopen it with ANDROID_DLEXT_USE_LIBRARY_FD
+  /// instead of copying it to the files dir. Objects must have a DT_SONAME that matches their filename, since the
+  /// linker can only find already opened dependencies by their SONAME.
+  bool memfdStaging = false;
+  /// @brief content_hashing: hash every object in the pass that stages it, fail copies that do not match the hash an
+  /// unchanged source was staged with before, and check that staged objects are unchanged since they were hashed
+  /// before they are opened. When disabled, nothing is verified.
+  bool contentHashing = true;
+  /// @brief prune_libs: only stage libs that early mods or mods depend on, directly or transitively. Libs that are only
+  /// ever opened by name at runtime (rather than through DT_NEEDED) are left unstaged and will fail to open.
+  bool pruneLibs = false;
+  /// @brief verify_symbols: before opening an object, check that every symbol it requires, at the version it requires
+  /// it, is defined by the global group or one of its dependencies. Objects that would fail to open are failed with the
+  /// missing symbols instead, without being opened. Objects the check cannot see everything of, because a dependency
+  /// is neither ours nor loaded yet, are opened unchecked.
+  bool verifySymbols = true;
+  /// @brief prefetch_budget: while a phase is being opened, read the objects about to be opened into the page cache on
+  /// a background thread, keeping at most this many bytes ahead of the object being opened. 0 disables reading ahead.
+  uint64_t prefetchBudget = 64 * 1024 * 1024;
+  /// @brief deferred_mods: comma separated file names of mods that are not opened with the other mods. Each is opened,
+  /// along with everything it depends on, the first time a mod requires or looks it up, or when it is opened
+  /// explicitly. Only mods can be deferred, not libs or early mods. Mods can also be deferred by their policy file.
+  std::vector<std::string> deferredMods;
+  /// @brief failure_cache: remember objects that failed to open across launches, and fail them again without opening
+  /// them or their dependencies until the object, anything it depends on, any other file in the phase directories, the
+  /// config, the game, the OS or the modloader changes. Only failures of dlopen or the symbol check are recorded, and
+  /// only once everything the object depends on has opened. Not used for launches whose staged files cannot be
+  /// identified across launches, which are memfd staged ones without content hashing.
+  bool failureCache = true;
+
+  /// @brief Reads the config at the provided path. Missing files and unknown keys are ignored.
+  [[nodiscard]] static LoaderConfig read(std::filesystem::path const& path) noexcept;
+};
+
+/// @brief The config that is in effect for this launch
+[[nodiscard]] LoaderConfig& get_config() noexcept;
+
+/// @brief Reads the policy file of the object at path, if it has one. Missing files and unknown keys are ignored.
+[[nodiscard]] LoadPolicy read_policy(std::filesystem::path const& path) noexcept;
+/// @brief The policy of the object at path, read the first time it is asked for. Thread safe.
+[[nodiscard]] LoadPolicy policy_of(std::filesystem::path const& path) noexcept;
+
+}  // namespace modloader
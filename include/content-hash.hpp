@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// A fast, non-cryptographic 64 bit content hash, used to detect staged objects that do not match their source.
+// The bulk loop is the XXH3 accumulate/scramble construction, with NEON and SSE2 kernels and a scalar fallback.
+// It uses its own key and finalization, so its output is NOT compatible with XXH3 itself.
+namespace content_hash {
+
+/// @brief Bytes consumed by one pass of the accumulate kernel
+constexpr static size_t kStripeSize = 64;
+/// @brief Stripes accumulated between two scrambles
+constexpr static size_t kStripesPerBlock = 16;
+
+/// @brief Incrementally hashes a stream of bytes, so the hash can be computed while those bytes are copied.
+/// Feeding the same bytes in differently sized chunks always produces the same hash.
+class Hasher {
+ public:
+  Hasher() noexcept;
+
+  /// @brief Hashes the next bytes of the stream
+  void update(std::span<uint8_t const> bytes) noexcept;
+  /// @brief Returns the hash of every byte passed to update so far. The hasher may keep being updated afterwards.
+  [[nodiscard]] uint64_t finish() const noexcept;
+
+ private:
+  void consume_stripe(uint8_t const* stripe) noexcept;
+
+  alignas(16) std::array<uint64_t, 8> acc;
+  std::array<uint8_t, kStripeSize> pending{};
+  size_t pendingSize = 0;
+  size_t stripesInBlock = 0;
+  uint64_t total = 0;
+};
+
+/// @brief Hashes the provided bytes in one go
+[[nodiscard]] uint64_t hash(std::span<uint8_t const> bytes) noexcept;
+
+}  // namespace content_hash
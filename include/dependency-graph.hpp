@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "elf-metadata.hpp"
+#include "id-map.hpp"
+#include "loader.hpp"
+#include "string-interner.hpp"
+
+namespace modloader {
+
+class ThreadPool;
+
+/// @brief The DT_NEEDED entries of an object, resolved against the phase directories
+struct ScannedObject {
+  // false if the object could not be read, in which case it has no dependencies
+  bool readable;
+  // Resolved path and phase of every dependency that could be looked up, LoadPhase::None for unresolved ones
+  std::vector<std::pair<std::filesystem::path, LoadPhase>> needed;
+  // The lifecycle functions the object defines itself, so they can be located without dlsym once it is opened
+  elf_metadata::Lifecycle lifecycle;
+};
+
+/// @brief Scans the object at path, or returns the result of scanning it before. Thread safe.
+/// Paths always live under the directory of the phase they were resolved in, so the path alone determines the result.
+/// @return The scanned object, valid until @ref clearScanned is called
+ScannedObject const& getScanned(std::filesystem::path const& path, std::filesystem::path const& dependencyDir,
+                                LoadPhase phase);
+
+/// @brief Drops every scanned object, so that objects are scanned again the next time they are asked for.
+/// Must only be called while nothing is scanning, and once no reference from @ref getScanned or graph built from them
+/// is used anymore.
+void clearScanned() noexcept;
+
+/// @brief Reads and resolves the dependencies of roots and everything they transitively depend on, on the pool.
+/// Afterwards, graphs of any of these objects are built without touching the filesystem. The graphs are the same as
+/// without the prescan, it only changes when and where objects are read.
+/// @param roots The objects to start from, all in the provided phase
+void prescanDependencies(std::span<SharedObject const> roots, std::filesystem::path const& dependencyDir,
+                         LoadPhase phase, ThreadPool& pool);
+
+/// @brief Every object reachable from a set of roots as one flat graph. Each path is stored once and identified by its
+/// node id, edges are stored contiguously per node. Memory grows with nodes + edges, not with the number of paths
+/// through the graph like nested Dependency trees do. Everything but the path strings themselves is allocated from the
+/// memory resource the graph is built with.
+class DependencyGraph {
+ public:
+  using NodeId = uint32_t;
+
+  /// @brief The order every root of the graph is opened in, walked once for all roots instead of once per root
+  struct Plan {
+    /// @brief The objects opened for one root: its dependencies that no earlier root already walked, then the root
+    struct Group {
+      NodeId root;
+      // The dependencies of root opened before it are steps[begin, end)
+      uint32_t begin;
+      uint32_t end;
+    };
+    std::pmr::vector<Group> groups;
+    std::pmr::vector<NodeId> steps;
+    /// @brief Every cycle found while walking, as the nodes along the cycle
+    std::vector<std::vector<NodeId>> cycles;
+
+    [[nodiscard]] std::span<NodeId const> dependencies(Group const& group) const noexcept {
+      return { steps.data() + group.begin, steps.data() + group.end };
+    }
+  };
+
+  /// @brief Builds the graph of roots and everything they transitively depend on, from @ref getScanned.
+  /// Roots get the first ids, in order.
+  /// @param resource Where the graph, and everything computed from it, is allocated from. Must outlive the graph.
+  [[nodiscard]] static DependencyGraph build(
+      std::span<SharedObject const> roots, std::filesystem::path const& dependencyDir, LoadPhase phase,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  [[nodiscard]] std::pmr::memory_resource* resource() const noexcept {
+    return phases.get_allocator().resource();
+  }
+
+  [[nodiscard]] size_t size() const noexcept {
+    return phases.size();
+  }
+  [[nodiscard]] size_t edgeCount() const noexcept {
+    return edges.size();
+  }
+  /// @brief The number of roots the graph was built from, they are the nodes [0, rootCount())
+  [[nodiscard]] size_t rootCount() const noexcept {
+    return roots;
+  }
+  [[nodiscard]] std::optional<NodeId> find(std::string_view path) const noexcept;
+  [[nodiscard]] std::filesystem::path const& path(NodeId id) const noexcept {
+    return paths[id];
+  }
+  /// @brief The interned id of the path of the node
+  [[nodiscard]] StringId pathId(NodeId id) const noexcept {
+    return pathIds[id];
+  }
+  /// @brief The phase the node was resolved in, LoadPhase::None for dependencies that could not be resolved
+  [[nodiscard]] LoadPhase phase(NodeId id) const noexcept {
+    return phases[id];
+  }
+  [[nodiscard]] bool missing(NodeId id) const noexcept {
+    return phases[id] == LoadPhase::None;
+  }
+  /// @brief What scanning the object of the node found, nullptr for missing dependencies
+  [[nodiscard]] ScannedObject const* scanned(NodeId id) const noexcept {
+    return scannedObjects[id];
+  }
+  /// @brief The direct dependencies of id, in DT_NEEDED order
+  [[nodiscard]] std::span<NodeId const> dependencies(NodeId id) const noexcept {
+    return { edges.data() + edgeOffsets[id], edges.data() + edgeOffsets[id + 1] };
+  }
+
+  /// @brief The resolved dependencies of id, in the order they are walked when sorting: descending by path
+  [[nodiscard]] std::span<NodeId const> sortedDependencies(NodeId id) const noexcept {
+    return { sortedEdges.data() + sortedEdgeOffsets[id], sortedEdges.data() + sortedEdgeOffsets[id + 1] };
+  }
+
+  /// @brief The order the dependencies of id must be opened in, excluding id itself and missing dependencies.
+  /// This is the order topologicalSort produces for the dependency tree of id. Runs in O(V + E), without recursion.
+  /// @param cycles If provided, every cycle found is appended to it, as the nodes along the cycle
+  [[nodiscard]] std::pmr::vector<NodeId> loadOrder(NodeId id,
+                                                   std::vector<std::vector<NodeId>>* cycles = nullptr) const;
+  /// @brief The order all roots are opened in, in root order. Each group holds what @ref loadOrder returns for its
+  /// root, minus everything an earlier group already holds, so every node is walked once per graph.
+  [[nodiscard]] Plan plan() const;
+  /// @brief id and everything it transitively depends on, each once, breadth first, with edges as indices into the
+  /// result. For results that outlive the graph, such as FailedMod.
+  [[nodiscard]] std::vector<DependencyNode> nodesOf(NodeId id) const;
+
+ private:
+  enum struct Mark : uint8_t {
+    None,
+    // Entered, but not all of its dependencies have been placed yet
+    Active,
+    Done,
+  };
+
+  explicit DependencyGraph(std::pmr::memory_resource* resource)
+      : paths(resource),
+        pathIds(resource),
+        ids(resource),
+        phases(resource),
+        edgeOffsets(resource),
+        edges(resource),
+        sortedEdgeOffsets(resource),
+        sortedEdges(resource),
+        scannedObjects(resource) {}
+
+  // The nodes being walked, and the index of the next dependency of each to walk
+  using WalkStack = std::pmr::vector<std::pair<NodeId, uint32_t>>;
+
+  NodeId intern(std::filesystem::path const& path, LoadPhase phase);
+  /// @brief Appends the dependencies of id that are not marked yet to order, marking them as it goes
+  /// @param stack Scratch space, empty before and after the walk. Shared between walks so it is only allocated once.
+  void walk(NodeId id, std::pmr::vector<Mark>& marks, std::pmr::vector<NodeId>& order, WalkStack& stack,
+            std::vector<std::vector<NodeId>>* cycles) const;
+
+  size_t roots{};
+
+  std::pmr::deque<std::filesystem::path> paths;
+  std::pmr::vector<StringId> pathIds;
+  // Interned path to node
+  IdMap<NodeId> ids;
+  std::pmr::vector<LoadPhase> phases;
+  // The dependencies of node i are edges[edgeOffsets[i], edgeOffsets[i + 1])
+  std::pmr::vector<uint32_t> edgeOffsets;
+  std::pmr::vector<NodeId> edges;
+  // The same edges without missing dependencies, sorted once when the graph is built
+  std::pmr::vector<uint32_t> sortedEdgeOffsets;
+  std::pmr::vector<NodeId> sortedEdges;
+  // Owned by the memo of @ref getScanned, which keeps them alive until @ref clearScanned
+  std::pmr::vector<ScannedObject const*> scannedObjects;
+};
+
+}  // namespace modloader
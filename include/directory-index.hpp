@@ -0,0 +1,62 @@
+#pragma once
+
+#include <sys/types.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "id-map.hpp"
+#include "loader.hpp"
+
+namespace modloader {
+
+/// @brief A file found directly under one of the phase directories
+struct IndexedFile {
+  LoadPhase phase;
+  std::filesystem::path path;
+  ino_t inode;
+  bool directory;
+};
+
+/// @brief Every file directly under each phase directory of a root, read with one directory pass per phase.
+/// Lookups and listings are answered from memory instead of stat'ing or walking the directories again.
+class DirectoryIndex {
+ public:
+  /// @brief Reads every phase directory under root. Memfd staged objects are indexed instead when memfd staging is
+  /// in use.
+  [[nodiscard]] static DirectoryIndex build(std::filesystem::path const& root) noexcept;
+
+  /// @brief Finds a file by name, searching phases in the same order the loader resolves dependencies in:
+  /// every phase up to and including the provided one, then shims.
+  /// @return The file, or nullptr if no phase has it
+  [[nodiscard]] IndexedFile const* find(LoadPhase phase, std::string_view name) const noexcept;
+
+  /// @brief Every file of the provided phase, in directory order
+  [[nodiscard]] std::vector<IndexedFile const*> list(LoadPhase phase) const noexcept;
+
+  [[nodiscard]] size_t size() const noexcept {
+    return files.size();
+  }
+
+ private:
+  void add(LoadPhase phase, std::filesystem::path path, ino_t inode, bool directory);
+
+  std::vector<IndexedFile> files;
+  /// @brief Interned filename to indices into files, in load phase order
+  IdMap<std::vector<size_t>> byName;
+};
+
+/// @brief The index of the provided root, built the first time it is asked for. Thread safe.
+/// The returned index stays valid while it is held, even if it is invalidated in the meantime.
+[[nodiscard]] std::shared_ptr<DirectoryIndex const> get_directory_index(std::filesystem::path const& root) noexcept;
+
+/// @brief Drops every built index, must be called whenever the contents of an indexed root change
+void invalidate_directory_indices() noexcept;
+
+/// @brief Drops the index of the root that path is in, must be called whenever the loader removes a file from a root
+/// that may have been indexed. Thread safe.
+void invalidate_directory_index_of(std::filesystem::path const& path) noexcept;
+
+}  // namespace modloader
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <elf.h>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+
+#include "elf-utils.hpp"
+#include "file-handles.hpp"
+#include "staging.hpp"
+
+namespace modloader {
+
+/// @brief A read only mapping of a whole ELF file, whose headers have been checked to lie within the file.
+/// Images are shared through a process wide cache, so every file is mapped once no matter how many readers it has.
+class ElfImage {
+ public:
+  ElfImage(ElfImage const&) = delete;
+  ElfImage& operator=(ElfImage const&) = delete;
+
+  /// @brief Maps the object at path, or returns the image mapped for it before if the file is unchanged since.
+  /// Paths of objects staged into memfds are mapped through their memfd. Thread safe.
+  /// @return The image, or nullptr if the file cannot be mapped or is not a valid 64 bit ELF
+  [[nodiscard]] static std::shared_ptr<ElfImage const> open(std::filesystem::path const& path) noexcept;
+  /// @brief Drops every cached image. Images still referenced elsewhere stay mapped until they are released.
+  static void clearCache() noexcept;
+
+  [[nodiscard]] std::span<uint8_t const> bytes() const noexcept {
+    return mapping.bytes();
+  }
+  [[nodiscard]] Elf64_Ehdr const& header() const noexcept {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return *reinterpret_cast<Elf64_Ehdr const*>(bytes().data());
+  }
+  [[nodiscard]] std::filesystem::path const& path() const noexcept {
+    return filePath;
+  }
+  [[nodiscard]] staging::FileRecord const& identity() const noexcept {
+    return fileIdentity;
+  }
+  /// @brief A reader of the dynamic segment that reads from the mapping instead of the file
+  [[nodiscard]] std::optional<elf_utils::DynamicReader> dynamic() const noexcept;
+  /// @brief The symbol lookup over the section headers, built the first time it is asked for. Thread safe.
+  /// @return The lookup, or nullptr if the section headers are malformed
+  [[nodiscard]] elf_utils::SymbolLookup const* symbols() const noexcept;
+
+ private:
+  ElfImage(std::filesystem::path path, staging::FileRecord identity, int fd, size_t size)
+      : filePath(std::move(path)), fileIdentity(identity), mapping(fd, size) {}
+
+  /// @brief Whether the ELF, program and section headers all lie within the mapping
+  [[nodiscard]] bool validate() const noexcept;
+
+  std::filesystem::path filePath;
+  staging::FileRecord fileIdentity;
+  Mapping mapping;
+  mutable std::once_flag symbolsBuilt;
+  mutable std::optional<elf_utils::SymbolLookup> lookup;
+};
+
+}  // namespace modloader
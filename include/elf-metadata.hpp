@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "elf-image.hpp"
+
+// Everything the loader needs to know about an object before opening it, persisted across launches so that an
+// unchanged object is never parsed twice.
+namespace elf_metadata {
+
+using namespace std::literals::string_view_literals;
+/// @brief Name of the metadata cache that is persisted in the files dir
+constexpr static std::string_view kCacheName = ".elf_metadata"sv;
+
+/// @brief The lifecycle functions an object may export, as bit flags
+enum Export : uint8_t {
+  kSetup = 1 << 0,
+  kLoad = 1 << 1,
+  kLateLoad = 1 << 2,
+  kUnload = 1 << 3,
+};
+constexpr static size_t kExportCount = 4;
+
+/// @brief Which lifecycle functions an object defines itself, and where
+struct Lifecycle {
+  /// @brief Bitwise or of the @ref Export values of the functions
+  uint8_t exports{};
+  /// @brief The st_value of each function, relative to the load base, indexed by the bit position of its @ref Export.
+  /// 0 for functions that are not defined, or that cannot be located without dlsym, such as IFUNCs.
+  std::array<uint64_t, kExportCount> values{};
+
+  [[nodiscard]] constexpr bool exported(Export value) const noexcept {
+    return (exports & value) != 0;
+  }
+  [[nodiscard]] constexpr uint64_t valueOf(Export value) const noexcept {
+    return values[std::countr_zero(static_cast<unsigned>(value))];
+  }
+};
+
+struct Metadata {
+  /// @brief DT_NEEDED names, in the order they appear in the dynamic section
+  std::vector<std::string> needed;
+  /// @brief DT_SONAME, empty if the object has none
+  std::string soname;
+  /// @brief Hex encoded NT_GNU_BUILD_ID, empty if the object has none
+  std::string buildId;
+  Lifecycle lifecycle;
+};
+
+/// @brief Reads the metadata of a mapped ELF file through its program headers
+/// @return The metadata, or nullopt if the file has a malformed dynamic segment
+[[nodiscard]] std::optional<Metadata> parse(modloader::ElfImage const& image) noexcept;
+
+/// @brief Returns the metadata of the object at path, from the cache when the object is unchanged since it was cached.
+/// Otherwise the object is parsed and the cache is updated. Thread safe.
+/// @return The metadata, or nullopt if the object could not be read or parsed
+[[nodiscard]] std::optional<Metadata> get(std::filesystem::path const& path) noexcept;
+
+/// @brief Caches the metadata of source for copy as well, if source was looked up during this launch and record, a
+/// staging manifest record, describes a copy made from that same source. The copy then need not be parsed either.
+void reuse(std::filesystem::path const& source, std::filesystem::path const& copy,
+           staging::FileRecord const& record) noexcept;
+
+/// @brief Replaces the in-memory cache with the one persisted at path. Missing or malformed caches read as empty.
+void load(std::filesystem::path const& path) noexcept;
+/// @brief Writes the objects looked up since @ref load to the path it was loaded from, replacing the previous cache
+/// atomically. Objects that were not looked up are dropped. Does nothing if the cache would not change.
+/// @return true on success, false otherwise
+bool save() noexcept;
+
+}  // namespace elf_metadata
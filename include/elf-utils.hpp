@@ -1,26 +1,204 @@
-#pragma once
-
-#include <span>
-#include <string>
-
-// NOTE: This is 64 bit specific!
-// For 32 bit support, this file will need to support Elf32_Shdr*, etc.
-namespace elf_utils {
-
-  template <typename T>
-  T& readAtOffset(std::span<uint8_t> f, uint64_t offset) noexcept {
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    return *reinterpret_cast<T*>(&f[offset]);
-  }
-
-  template <typename T>
-  std::span<T> readManyAtOffset(std::span<uint8_t> f, uint64_t offset, size_t amount, size_t size) noexcept {
-    uint8_t* begin = &readAtOffset<uint8_t>(f, offset);
-    uint8_t* end = begin + (amount * size);
-    return std::span<T>(reinterpret_cast<T*>(begin), reinterpret_cast<T*>(end));
-  }
-  
-  void* getSymbol(std::span<uint8_t> f, std::string_view symbol_name);
-
-  uintptr_t baseAddr(char const* soname);
+#pragma once
+
+#include <elf.h>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// NOTE: This is 64 bit specific!
+// For 32 bit support, this file will need to support Elf32_Shdr*, etc.
+namespace elf_utils {
+
+  template <typename T>
+  T& readAtOffset(std::span<uint8_t> f, uint64_t offset) noexcept {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return *reinterpret_cast<T*>(&f[offset]);
+  }
+
+  template <typename T>
+  std::span<T> readManyAtOffset(std::span<uint8_t> f, uint64_t offset, size_t amount, size_t size) noexcept {
+    uint8_t* begin = &readAtOffset<uint8_t>(f, offset);
+    uint8_t* end = begin + (amount * size);
+    return std::span<T>(reinterpret_cast<T*>(begin), reinterpret_cast<T*>(end));
+  }
+  
+  /// @brief The value of the symbol called symbol_name in the mapped file f, or nullptr if it is not defined.
+  /// Builds a @ref SymbolLookup for a single query, create one directly to look up more than one symbol.
+  void* getSymbol(std::span<uint8_t> f, std::string_view symbol_name);
+
+  uintptr_t baseAddr(char const* soname);
+
+  class SymbolTable;
+
+  /// @brief An undefined symbol an object requires
+  struct RequiredSymbol {
+    std::string_view name;
+    // The version named for it in DT_VERNEED, empty when the object does not ask for one
+    std::string_view version;
+  };
+
+  /// @brief A DT_GNU_HASH table held in memory
+  struct GnuHashTable {
+    uint32_t symoffset{};
+    uint32_t bloomShift{};
+    std::span<uint64_t const> bloom;
+    std::span<uint32_t const> buckets;
+    std::span<uint32_t const> chains;
+  };
+
+  /// @brief A DT_HASH table held in memory
+  struct SysvHashTable {
+    std::span<uint32_t const> buckets;
+    std::span<uint32_t const> chains;
+  };
+
+  /// @brief Looks up symbols in an ELF file mapped into memory, through its section headers.
+  /// .dynsym is searched through its GNU or SysV hash section. .symtab has no hash table, so a sorted index of it is
+  /// built once instead. Each table is read with the string table its sh_link names.
+  class SymbolLookup {
+   public:
+    /// @brief Indexes the symbol tables of file, which must stay mapped for as long as the lookup is used
+    /// @return The lookup, or nullopt if the section headers are malformed
+    [[nodiscard]] static std::optional<SymbolLookup> create(std::span<uint8_t const> file) noexcept;
+
+    /// @brief The value of the defined symbol called name, from .dynsym if it is there, otherwise from .symtab
+    [[nodiscard]] std::optional<uint64_t> find(std::string_view name) const noexcept;
+
+   private:
+    struct Table {
+      std::span<Elf64_Sym const> symbols;
+      std::span<char const> strings;
+
+      [[nodiscard]] std::string_view nameOf(uint32_t index) const noexcept;
+    };
+
+    SymbolLookup() = default;
+
+    Table dynsym;
+    GnuHashTable gnu;
+    SysvHashTable sysv;
+    Table symtab;
+    // Hash and index of every named .symtab entry, ordered by hash, then by index
+    std::vector<std::pair<uint32_t, uint32_t>> symtabIndex;
+  };
+
+  /// @brief Reads the dynamic linking information of an ELF file through its program headers, with small preads
+  /// instead of mapping the whole file. Section headers are never used, so stripped files work too.
+  /// Every offset taken from the file is checked against the file size, so malformed files fail instead of crashing.
+  class DynamicReader {
+   public:
+    /// @brief Reads the ELF header, program headers and dynamic segment of fd
+    /// @param fd The file to read from, must stay open for as long as the reader is used
+    /// @param size The size of the file
+    /// @return The reader, or nullopt if the file is not a valid 64 bit ELF
+    [[nodiscard]] static std::optional<DynamicReader> open(int fd, uint64_t size) noexcept;
+    /// @brief Reads the ELF header, program headers and dynamic segment of a file that is already in memory
+    /// @param image The whole file, must stay valid for as long as the reader is used
+    /// @return The reader, or nullopt if the file is not a valid 64 bit ELF
+    [[nodiscard]] static std::optional<DynamicReader> open(std::span<uint8_t const> image) noexcept;
+
+    /// @brief DT_NEEDED names, in the order they appear in the dynamic segment. Unreadable names are skipped.
+    [[nodiscard]] std::vector<std::string> needed() const noexcept;
+    /// @brief DT_SONAME, empty if there is none
+    [[nodiscard]] std::string soname() const noexcept;
+    /// @brief The hex encoded NT_GNU_BUILD_ID note, empty if there is none
+    [[nodiscard]] std::string buildId() const noexcept;
+    /// @brief Whether the dynamic symbol table defines symbol, looked up through DT_GNU_HASH or DT_HASH
+    [[nodiscard]] bool defines(std::string_view symbol) const noexcept;
+    /// @brief The dynamic symbol called symbol, looked up like @ref defines
+    /// @return The symbol, or nullopt if it is not defined
+    [[nodiscard]] std::optional<Elf64_Sym> find(std::string_view symbol) const noexcept;
+    /// @brief Reads the whole dynamic symbol table, its strings and its hash table into memory, for when many symbols
+    /// are looked up
+    /// @return The table, or nullopt if it is missing, unreadable or larger than we are willing to read
+    [[nodiscard]] std::optional<SymbolTable> symbolTable() const noexcept;
+
+   private:
+    DynamicReader(int fd, uint64_t size) : fd(fd), size(size) {}
+    explicit DynamicReader(std::span<uint8_t const> image) : fd(-1), size(image.size()), image(image) {}
+
+    /// @brief Reads the headers and dynamic segment, shared by both ways of opening a reader
+    [[nodiscard]] static std::optional<DynamicReader> parse(DynamicReader reader) noexcept;
+
+    template <typename T>
+    [[nodiscard]] std::optional<T> read(uint64_t offset) const noexcept;
+    [[nodiscard]] bool readInto(uint64_t offset, void* data, size_t length) const noexcept;
+    /// @brief Translates a virtual address to a file offset through the PT_LOAD segments
+    [[nodiscard]] std::optional<uint64_t> toOffset(uint64_t vaddr, uint64_t length) const noexcept;
+    /// @brief Reads the string at offset into the dynamic string table
+    [[nodiscard]] std::optional<std::string> readString(uint64_t offset) const noexcept;
+    [[nodiscard]] std::optional<std::pair<Elf64_Sym, std::string>> readSymbol(uint32_t index) const noexcept;
+    /// @brief The entry for symbol in the hash table, which may be an undefined reference to it
+    [[nodiscard]] std::optional<Elf64_Sym> gnuFind(std::string_view symbol) const noexcept;
+    [[nodiscard]] std::optional<Elf64_Sym> sysvFind(std::string_view symbol) const noexcept;
+    /// @brief The number of entries in the dynamic symbol table, derived from the hash table since it is not recorded
+    [[nodiscard]] std::optional<uint32_t> symbolCount() const noexcept;
+    /// @brief Reads the version of every symbol and the names DT_VERNEED gives them into table. Objects without
+    /// DT_VERSYM, or with unreadable versions, are left without versions.
+    void readVersions(SymbolTable& table) const noexcept;
+
+    int fd;
+    uint64_t size;
+    // The file when it is in memory, read from instead of fd
+    std::span<uint8_t const> image;
+    std::vector<Elf64_Phdr> loads;
+    std::vector<Elf64_Phdr> notes;
+    std::vector<Elf64_Dyn> dynamic;
+    // File offsets of the tables named by the dynamic segment, 0 when absent
+    uint64_t strtab{};
+    uint64_t strsz{};
+    uint64_t symtab{};
+    uint64_t gnuHash{};
+    uint64_t sysvHash{};
+    uint64_t versym{};
+    uint64_t verneed{};
+    uint64_t verneedNum{};
+  };
+
+  /// @brief The dynamic symbol table of an ELF file, held in memory so that lookups cost no I/O
+  class SymbolTable {
+   public:
+    // The hash table views point into the vectors, which keep their buffers when moved but not when copied
+    SymbolTable(SymbolTable&&) noexcept = default;
+    SymbolTable& operator=(SymbolTable&&) noexcept = default;
+    SymbolTable(SymbolTable const&) = delete;
+    SymbolTable& operator=(SymbolTable const&) = delete;
+
+    /// @brief Whether the table defines symbol, looked up through the GNU hash table, or the SysV one without it
+    [[nodiscard]] bool defines(std::string_view symbol) const noexcept;
+    /// @brief The undefined symbols with global binding, all of which must resolve for the object to be opened with
+    /// RTLD_NOW. Undefined weak symbols may stay unresolved, so they are left out.
+    [[nodiscard]] std::vector<RequiredSymbol> required() const noexcept;
+
+    [[nodiscard]] size_t size() const noexcept {
+      return symbols.size();
+    }
+
+   private:
+    friend class DynamicReader;
+    SymbolTable() = default;
+
+    /// @brief The name of symbol, empty if it is out of bounds
+    [[nodiscard]] std::string_view nameOf(Elf64_Sym const& symbol) const noexcept;
+    /// @brief The version the symbol at index is required at, empty if it has none
+    [[nodiscard]] std::string_view versionOf(size_t index) const noexcept;
+    [[nodiscard]] bool matches(uint32_t index, std::string_view symbol) const noexcept;
+
+    std::vector<Elf64_Sym> symbols;
+    std::string strings;
+    // Backing storage of whichever hash table the object has, DT_GNU_HASH is preferred over DT_HASH
+    std::vector<uint64_t> bloom;
+    std::vector<uint32_t> buckets;
+    std::vector<uint32_t> chains;
+    GnuHashTable gnu;
+    SysvHashTable sysv;
+    // DT_VERSYM, one entry per symbol, empty if the object has no versions
+    std::vector<Elf64_Half> versions;
+    // Version index to the offset of its name in strings, from DT_VERNEED
+    std::vector<std::pair<Elf64_Half, uint32_t>> versionNames;
+  };
 }  // namespace
\ No newline at end of file
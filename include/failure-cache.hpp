@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "content-hash.hpp"
+
+// Objects that failed to open, persisted across launches so that an object that will fail again is not opened again.
+// A failure is recorded under a key identifying the object and everything it was opened against, and only stands for
+// as long as none of them change.
+namespace failure_cache {
+
+using namespace std::literals::string_view_literals;
+/// @brief Name of the failure cache that is persisted in the files dir
+constexpr static std::string_view kCacheName = ".failed_objects"sv;
+
+/// @brief Builds the key a failure is recorded under, from every file the failure may depend on
+class KeyBuilder {
+ public:
+  /// @brief Adds a file by its content hash if the staged bytes are known to have it, see staging::verified_hash_of.
+  /// Otherwise by its size, mtime and inode.
+  /// @return false if the file cannot be identified across launches, in which case the key must not be used
+  bool add(std::filesystem::path const& path) noexcept;
+  /// @brief Adds a dependency that could not be resolved, so that the key changes once it can be
+  void addMissing(std::string_view name) noexcept;
+  /// @brief Adds something that is not a file but may decide whether objects open, such as the OS build
+  void addValue(std::string_view value) noexcept;
+  [[nodiscard]] uint64_t finish() const noexcept {
+    return hasher.finish();
+  }
+
+ private:
+  content_hash::Hasher hasher;
+};
+
+/// @brief Replaces the in-memory cache with the one persisted at path. Missing or malformed caches, and caches
+/// written under a different environment, read as empty.
+/// @param environment Key of everything outside the files dir that objects may fail against, such as the libraries
+/// of the game
+void load(std::filesystem::path const& path, uint64_t environment) noexcept;
+/// @brief Whether a failure was recorded for path by an earlier launch under any key, so callers can skip building the
+/// key. Thread safe.
+[[nodiscard]] bool contains(std::filesystem::path const& path) noexcept;
+/// @brief The failure recorded for path by an earlier launch, if it was recorded under key. Thread safe.
+[[nodiscard]] std::optional<std::string> find(std::filesystem::path const& path, uint64_t key) noexcept;
+/// @brief Records that path failed with failure under key, replacing any failure recorded for it before. Thread safe.
+void record(std::filesystem::path const& path, uint64_t key, std::string_view failure) noexcept;
+/// @brief Drops the failure recorded for path, once it opened after all. Thread safe.
+void forget(std::filesystem::path const& path) noexcept;
+/// @brief Writes the failures looked up or recorded since @ref load to the path it was loaded from, replacing the
+/// previous cache atomically. Failures of objects that were not looked up are dropped. Does nothing if the cache would
+/// not change.
+/// @return true on success, false otherwise
+bool save() noexcept;
+
+}  // namespace failure_cache
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "log.h"
+
+namespace modloader {
+
+/// @brief Owns a file descriptor, closing it when destroyed
+struct UniqueFd {
+  int fd = -1;
+
+  explicit UniqueFd(int fd) : fd(fd) {}
+  UniqueFd(UniqueFd const&) = delete;
+  UniqueFd& operator=(UniqueFd const&) = delete;
+  ~UniqueFd() {
+    if (fd != -1 && close(fd) != 0) {
+      LOG_WARN("Failed to close fd: {}: {}", fd, std::strerror(errno));
+    }
+  }
+};
+
+/// @brief A read only mapping of a whole file, unmapped when destroyed
+struct Mapping {
+  void* address = MAP_FAILED;
+  size_t size = 0;
+
+  Mapping(int fd, size_t size) : size(size) {
+    if (size != 0) {
+      address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+  }
+  Mapping(Mapping const&) = delete;
+  Mapping& operator=(Mapping const&) = delete;
+  ~Mapping() {
+    if (address != MAP_FAILED && munmap(address, size) != 0) {
+      LOG_WARN("Failed to munmap: {}", std::strerror(errno));
+    }
+  }
+
+  [[nodiscard]] bool valid() const noexcept {
+    return size == 0 || address != MAP_FAILED;
+  }
+  [[nodiscard]] std::span<uint8_t const> bytes() const noexcept {
+    if (address == MAP_FAILED) {
+      return {};
+    }
+    return { static_cast<uint8_t const*>(address), size };
+  }
+};
+
+}  // namespace modloader
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "string-interner.hpp"
+
+namespace modloader {
+
+/// @brief An open addressing hash map keyed by interned string ids, with linear probing.
+/// Keys and values are stored in flat arrays, so lookups never chase pointers or hash strings.
+/// Pointers to values are invalidated when an insertion grows the map.
+template <typename Value>
+class IdMap {
+ public:
+  /// @param resource Where the keys and values are allocated from
+  explicit IdMap(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+      : keys(resource), values(resource) {}
+
+  [[nodiscard]] size_t size() const noexcept {
+    return count;
+  }
+  [[nodiscard]] bool empty() const noexcept {
+    return count == 0;
+  }
+
+  /// @brief Makes room for expected entries without growing again
+  void reserve(size_t expected) {
+    // Kept at most half full, so probe sequences stay short
+    auto capacity = std::bit_ceil(std::max<size_t>(expected * 2, kMinCapacity));
+    if (capacity > keys.size()) {
+      rehash(capacity);
+    }
+  }
+
+  [[nodiscard]] Value* find(StringId key) noexcept {
+    auto slot = locate(key);
+    return keys.empty() || keys[slot] == kEmpty ? nullptr : &values[slot];
+  }
+  [[nodiscard]] Value const* find(StringId key) const noexcept {
+    auto slot = locate(key);
+    return keys.empty() || keys[slot] == kEmpty ? nullptr : &values[slot];
+  }
+  [[nodiscard]] bool contains(StringId key) const noexcept {
+    return find(key) != nullptr;
+  }
+
+  /// @brief Inserts a value constructed from args if key is not present yet
+  /// @return The value for key, and whether it was inserted
+  template <typename... Args>
+  std::pair<Value*, bool> try_emplace(StringId key, Args&&... args) {
+    if ((count + 1) * 2 > keys.size()) {
+      rehash(std::max<size_t>(keys.size() * 2, kMinCapacity));
+    }
+    auto slot = locate(key);
+    if (keys[slot] != kEmpty) {
+      return { &values[slot], false };
+    }
+    keys[slot] = key;
+    values[slot] = Value(std::forward<Args>(args)...);
+    count++;
+    return { &values[slot], true };
+  }
+
+  void clear() noexcept {
+    keys.clear();
+    values.clear();
+    count = 0;
+  }
+
+  /// @brief Calls fn with every key and value, in no particular order
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (keys[i] != kEmpty) {
+        fn(keys[i], values[i]);
+      }
+    }
+  }
+
+ private:
+  constexpr static StringId kEmpty = ~StringId{};
+  constexpr static size_t kMinCapacity = 16;
+
+  /// @brief The slot holding key, or the empty slot it would be inserted into. keys must not be empty for the
+  /// result to be meaningful.
+  [[nodiscard]] size_t locate(StringId key) const noexcept {
+    if (keys.empty()) {
+      return 0;
+    }
+    auto mask = keys.size() - 1;
+    // Ids are handed out sequentially, spread them over the table
+    auto slot = static_cast<size_t>(key * 0x9E3779B9U) & mask;
+    while (keys[slot] != kEmpty && keys[slot] != key) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void rehash(size_t capacity) {
+    auto oldKeys = std::exchange(keys, std::pmr::vector<StringId>(capacity, kEmpty, keys.get_allocator()));
+    auto oldValues = std::exchange(values, std::pmr::vector<Value>(capacity, values.get_allocator()));
+    for (size_t i = 0; i < oldKeys.size(); i++) {
+      if (oldKeys[i] != kEmpty) {
+        auto slot = locate(oldKeys[i]);
+        keys[slot] = oldKeys[i];
+        values[slot] = std::move(oldValues[i]);
+      }
+    }
+  }
+
+  std::pmr::vector<StringId> keys;
+  std::pmr::vector<Value> values;
+  size_t count = 0;
+};
+
+/// @brief An open addressing hash set of interned string ids
+class IdSet {
+ public:
+  explicit IdSet(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : map(resource) {}
+
+  [[nodiscard]] size_t size() const noexcept {
+    return map.size();
+  }
+  [[nodiscard]] bool contains(StringId id) const noexcept {
+    return map.contains(id);
+  }
+  /// @return true if id was not in the set yet
+  bool insert(StringId id) {
+    return map.try_emplace(id).second;
+  }
+  void clear() noexcept {
+    map.clear();
+  }
+
+ private:
+  struct Empty {};
+  IdMap<Empty> map;
+};
+
+}  // namespace modloader
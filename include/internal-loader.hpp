@@ -2,30 +2,86 @@
 
 #include <deque>
 #include <filesystem>
+#include <memory>
+#include <optional>
 #include <span>
 #include <stack>
+#include <string_view>
 #include <type_traits>
 #include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#include "dependency-graph.hpp"
+#include "id-map.hpp"
 #include "loader.hpp"
+#include "phase-arena.hpp"
 
 namespace modloader {
 
+class ThreadPool;
 
 static_assert(std::is_move_assignable_v<LoadResult> && std::is_move_constructible_v<LoadResult>, "");
 
+/// @brief Lists the objects of phase in the order they are opened: by descending policy priority, then by path
 std::vector<SharedObject> listAllObjectsInPhase(std::filesystem::path const& dependencyDir, LoadPhase phase);
 
-// Moves FROM mods
+/// @brief Whether the mod at path is deferred by the loader config or its policy, see LoaderConfig::deferredMods
+[[nodiscard]] bool isDeferred(std::filesystem::path const& path) noexcept;
+/// @brief Whether name refers to the object at path. Names are file names, or with byId, also mod ids: a mod cannot
+/// report its id before it is opened, so ids are matched against the file name without its lib prefix and .so
+/// extension, ignoring case.
+[[nodiscard]] bool namesObject(std::string_view name, std::filesystem::path const& path, bool byId) noexcept;
+/// @brief The mods that are deferred by the loader config, which @ref planPhases leaves out of the mods phase
+[[nodiscard]] std::vector<SharedObject> listDeferredMods(std::filesystem::path const& dependencyDir);
+
+/// @brief Find and create a SharedObject representing the resolved dependency, if it can be found.
+/// @param dependencyDir The top level directory
+/// @param phase The load phase of the dependency to start the search from
+/// @param name The dependency's name to open
+/// @return The returned pair on success, nullopt otherwise
+std::optional<std::pair<SharedObject, LoadPhase>> findSharedObject(std::filesystem::path const& dependencyDir,
+                                                                   LoadPhase phase, std::filesystem::path const& name);
+
+/// @brief Finds the libs that no early mod or mod depends on, directly or through other libs.
+/// Libs that are only opened by name at runtime cannot be seen here, and are reported as unreachable.
+/// Objects are read through the ELF metadata cache, which is keyed on the identity of the source, so unchanged sources
+/// are not parsed again. See elf_metadata::reuse for handing what was read to the staged copies.
+/// @param dependencyDir The top level directory to resolve dependencies in
+/// @return The filenames of the unreachable libs
+std::unordered_set<std::string> findUnreachableLibs(std::filesystem::path const& dependencyDir);
+
+/// @brief Everything one phase opens, worked out before any of it is opened.
+/// The graph and order live in the plan's own arena, which is released with the plan. Plans are moved, never assigned.
+struct PhasePlan {
+  // First, so that it is destroyed after everything allocated from it
+  std::unique_ptr<PhaseArena> arena;
+  LoadPhase phase;
+  DependencyGraph graph;
+  DependencyGraph::Plan order;
+};
+
+/// @brief Plans opening mods and everything they depend on, as one load order for the whole phase
+/// @param pool The pool to scan objects on
+[[nodiscard]] PhasePlan planPhase(std::span<SharedObject const> mods, std::filesystem::path const& dependencyDir,
+                                  LoadPhase phase, ThreadPool& pool);
+/// @brief Plans the libs, early mods and mods phases, in that order. Objects are scanned once for all of them.
+/// Deferred mods are scanned, but not planned.
+[[nodiscard]] std::deque<PhasePlan> planPhases(std::filesystem::path const& dependencyDir);
+/// @brief Opens everything in plan that is not in skipLoad yet, adding it to skipLoad.
+/// Produces the same results as @ref loadMods for the objects the plan was made from.
+[[nodiscard]] std::vector<LoadResult> executePlan(PhasePlan const& plan, IdSet& skipLoad);
+
+/// @brief Plans and opens mods, see @ref planPhase and @ref executePlan
 [[nodiscard]] std::vector<LoadResult> loadMods(std::span<SharedObject> mods, std::filesystem::path const& dependencyDir,
-                                               std::unordered_set<std::string>& skipLoad, LoadPhase phase);
+                                               IdSet& skipLoad, LoadPhase phase);
 [[nodiscard]] std::vector<LoadResult> loadMod(SharedObject&& mod, std::filesystem::path const& dependencyDir,
-                                              std::unordered_set<std::string>& skipLoad, LoadPhase phase);
+                                              IdSet& skipLoad, LoadPhase phase);
 
 /// @brief Copies all of the files to be loaded by the modloader to a location that it can mark as executable.
-/// Does NOT use symlinks to avoid tainting permissions.
+/// Does NOT use symlinks to avoid tainting permissions. Files are reflinked where possible, and only copied when that
+/// does not work. Only files that changed since the last call are staged again.
 /// @param filesDir The destination folder to copy to
 /// @return true on success, false otherwise
 [[nodiscard]] bool copy_all(std::filesystem::path const& filesDir) noexcept;
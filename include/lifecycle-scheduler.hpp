@@ -0,0 +1,47 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+
+#include "loader.hpp"
+
+namespace modloader {
+
+/// @brief Calls setup on every loaded mod in results, once the setups of all mods in results it depends on have
+/// finished. Mods whose policy declares them thread safe are set up on a pool of workers, the others in order on the
+/// calling thread. Returns once every setup has finished.
+/// @param results The results of opening a phase, in the order they were opened
+/// @param dependencyDir The root the results were opened from
+void setupMods(std::span<LoadResult> results, std::filesystem::path const& dependencyDir);
+/// @brief Calls setup on mod, for when it is required before its turn. If its setup is already running on a worker,
+/// waits for it to finish instead. Thread safe. From a worker, only mods whose policy declares them thread safe are
+/// set up. A setup worker hands the setup of any other mod to the thread that started it and waits for it, a late_load
+/// worker fails with a logged error.
+/// @return false if the mod has no setup function, or it could not be called here
+bool setupNow(LoadedMod& mod) noexcept;
+/// @brief Whether the calling thread is a worker making setup or late_load calls for @ref setupMods or
+/// @ref lateLoadMods
+[[nodiscard]] bool onLifecycleWorker() noexcept;
+
+/// @brief Calls late_load on every mod, once the late_loads of all mods it depends on have finished. Mods whose policy
+/// asks for an async late_load are called on background workers, the others in order on the calling thread. Returns
+/// once the calling thread has made its calls, use @ref awaitLateLoads to wait for the rest.
+/// The mods must stay where they are until the late_loads have finished.
+/// @param mods The mods in the order they were opened
+/// @param dependencyDir The root the mods were opened from
+void lateLoadMods(std::span<LoadedMod* const> mods, std::filesystem::path const& dependencyDir);
+/// @brief Calls late_load on mod, for when it is required before its turn. If its late_load is already running on a
+/// worker, waits for it to finish instead. Thread safe.
+/// @return false if the mod has no late_load function
+bool lateLoadNow(LoadedMod& mod) noexcept;
+/// @brief Calls late_load on a mod that the late_loads started by @ref lateLoadMods do not include, such as a deferred
+/// mod, once the late_loads of the mods it depends on have finished. Thread safe.
+/// @return false if the mod has no late_load function
+bool lateLoadAfterDependencies(LoadedMod& mod) noexcept;
+/// @brief Blocks until every late_load started by @ref lateLoadMods has finished. Returns right away when called from
+/// inside one of those late_loads, which would otherwise wait for itself. Thread safe.
+void awaitLateLoads() noexcept;
+/// @brief Whether every late_load started by @ref lateLoadMods has finished. Thread safe.
+[[nodiscard]] bool lateLoadsFinished() noexcept;
+
+}  // namespace modloader
@@ -30,8 +30,9 @@
 #include <fmt/compile.h>
 #include <fmt/core.h>
 
+// lvl fills the first placeholder, so the caller's arguments line up with the placeholders in str
 #define SL2_LOG(lvl, str, ...) \
-  fmt::print(FMT_COMPILE(MOD_ID "|v" MOD_VERSION str ": {}: "), lvl __VA_OPT__(, __VA_ARGS__))
+  fmt::print(FMT_COMPILE(MOD_ID "|v" MOD_VERSION " {}: " str "\n"), lvl __VA_OPT__(, __VA_ARGS__))
 
 #define LOG_VERBOSE(...) SL2_LOG("VERBOSE", __VA_ARGS__)
 #define LOG_DEBUG(...) SL2_LOG("DEBUG", __VA_ARGS__)
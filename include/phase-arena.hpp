@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace modloader {
+
+/// @brief Forwards to another memory resource, counting what goes through it. Not thread safe.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  explicit CountingResource(std::pmr::memory_resource* upstream) noexcept : upstream(upstream) {}
+
+  [[nodiscard]] size_t allocations() const noexcept {
+    return allocationCount;
+  }
+  [[nodiscard]] size_t bytes() const noexcept {
+    return byteCount;
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+  [[nodiscard]] bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override;
+
+  std::pmr::memory_resource* upstream;
+  size_t allocationCount = 0;
+  size_t byteCount = 0;
+};
+
+/// @brief A monotonic arena for the short lived allocations of one load phase, such as its dependency graph and plan.
+/// Nothing is freed until the arena is destroyed, at which point everything is released at once. Not thread safe.
+class PhaseArena {
+ public:
+  /// @brief The size of the first block the arena takes from the heap, later blocks grow geometrically
+  constexpr static size_t kInitialSize = 16 * 1024;
+
+  PhaseArena() = default;
+  PhaseArena(PhaseArena const&) = delete;
+  PhaseArena& operator=(PhaseArena const&) = delete;
+
+  [[nodiscard]] std::pmr::memory_resource* resource() noexcept {
+    return &requests;
+  }
+  /// @brief The number of allocations served by the arena
+  [[nodiscard]] size_t allocations() const noexcept {
+    return requests.allocations();
+  }
+  /// @brief The number of bytes served by the arena
+  [[nodiscard]] size_t bytes() const noexcept {
+    return requests.bytes();
+  }
+  /// @brief The number of blocks the arena had to take from the heap to serve them
+  [[nodiscard]] size_t heapAllocations() const noexcept {
+    return heap.allocations();
+  }
+
+ private:
+  // Declared in the order they depend on each other, so they are destroyed in the reverse order
+  CountingResource heap{ std::pmr::new_delete_resource() };
+  std::pmr::monotonic_buffer_resource arena{ kInitialSize, &heap };
+  CountingResource requests{ &arena };
+};
+
+}  // namespace modloader
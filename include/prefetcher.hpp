@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "dependency-graph.hpp"
+
+namespace modloader {
+
+/// @brief Reads objects into the page cache on a background thread, ahead of them being opened in a known order, so
+/// that the linker finds them in memory instead of faulting them in from storage one page at a time.
+/// At most budget bytes of objects are read ahead of the one being opened. Objects staged into memfds are already in
+/// memory, so they are skipped.
+class Prefetcher {
+ public:
+  /// @param graph The graph the nodes belong to, must outlive the prefetcher
+  /// @param order The nodes in the order they will be opened
+  /// @param budget The most bytes to read ahead of the object being opened, at least one object is always read ahead
+  Prefetcher(DependencyGraph const& graph, std::span<DependencyGraph::NodeId const> order, uint64_t budget);
+  Prefetcher(Prefetcher const&) = delete;
+  Prefetcher& operator=(Prefetcher const&) = delete;
+  /// @brief Stops reading ahead, without waiting for the objects that have not been read yet
+  ~Prefetcher();
+
+  /// @brief Moves the cursor to id, which is about to be opened. The objects before it in the order no longer count
+  /// against the budget. Nodes that are not in the order, or that lie behind the cursor, are ignored.
+  void opening(DependencyGraph::NodeId id) noexcept;
+
+  /// @return The number of objects read ahead so far
+  [[nodiscard]] size_t readAhead() const noexcept;
+
+ private:
+  constexpr static uint32_t kNotPlanned = ~uint32_t{};
+
+  void run() noexcept;
+
+  DependencyGraph const& graph;
+  std::vector<DependencyGraph::NodeId> order;
+  // Position of every node in order, kNotPlanned for nodes that are not in it
+  std::vector<uint32_t> positions;
+  // Bytes read ahead for each position, 0 until it has been read
+  std::vector<uint64_t> sizes;
+  uint64_t budget;
+
+  mutable std::mutex mutex;
+  std::condition_variable moved;
+  // The position being opened, and everything read ahead of it that has not been opened yet
+  size_t cursor = 0;
+  uint64_t inFlight = 0;
+  bool stopping = false;
+  size_t prefetched = 0;
+  uint64_t prefetchedBytes = 0;
+  std::thread worker;
+};
+
+}  // namespace modloader
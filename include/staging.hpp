@@ -0,0 +1,182 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace modloader {
+class ThreadPool;
+}
+
+namespace staging {
+
+using namespace std::literals::string_view_literals;
+/// @brief Name of the manifest file that is persisted in the files dir
+constexpr static std::string_view kManifestName = ".staging_manifest"sv;
+
+/// @brief Describes a single source file, as recorded in the manifest.
+/// size, mtime and inode describe the SOURCE file the copy was made from, hash describes the copied bytes and the
+/// staged fields describe the copy as staging left it.
+struct FileRecord {
+  uint64_t size{};
+  // Modification time, in nanoseconds
+  int64_t mtime{};
+  uint64_t inode{};
+  // content_hash of the staged bytes, taken in the pass that copied them. 0 when content hashing is disabled, or for
+  // reflinks of a source that was never copied
+  uint64_t hash{};
+  // Identity of the staged copy, all 0 if the file has no staged copy
+  uint64_t stagedSize{};
+  int64_t stagedMtime{};
+  uint64_t stagedInode{};
+
+  /// @brief Returns true if both records describe the same source file
+  [[nodiscard]] constexpr bool same_identity(FileRecord const& other) const noexcept {
+    return size == other.size && mtime == other.mtime && inode == other.inode;
+  }
+  /// @brief Returns true if staged, the identity of a file in the destination, is the copy this record was staged to
+  [[nodiscard]] constexpr bool same_staged(FileRecord const& staged) const noexcept {
+    return stagedInode != 0 && stagedSize == staged.size && stagedMtime == staged.mtime && stagedInode == staged.inode;
+  }
+};
+
+/// @brief The identity of the file described by st, with no hash
+[[nodiscard]] FileRecord identity_of(struct stat64 const& st) noexcept;
+
+/// @brief The records for a single phase
+struct PhaseManifest {
+  /// @brief Every file listed in the source, staged or not, keyed by path relative to the phase directory
+  std::unordered_map<std::string, FileRecord> files;
+  /// @brief Every directory listed in the source, keyed the same way, with the phase directory itself as "".
+  /// A directory that still has this identity has the same entries, so it is not listed again.
+  std::unordered_map<std::string, FileRecord> directories;
+};
+
+/// @brief Escapes backslashes, tabs and newlines in field, so that it can be written to a tab separated line
+[[nodiscard]] std::string escape_field(std::string_view field);
+/// @brief Reverses @ref escape_field
+/// @return The original field, or nullopt if field is not a valid escaped field
+[[nodiscard]] std::optional<std::string> unescape_field(std::string_view field);
+
+/// @brief The persisted collection of all staged files, keyed by phase directory name
+struct Manifest {
+  std::unordered_map<std::string, PhaseManifest> phases;
+
+  /// @brief Reads the manifest at the provided path. Missing or malformed manifests read as empty.
+  [[nodiscard]] static Manifest read(std::filesystem::path const& path) noexcept;
+  /// @brief Writes the manifest to the provided path, replacing any existing manifest atomically.
+  /// @return true on success, false otherwise
+  [[nodiscard]] bool write(std::filesystem::path const& path) const noexcept;
+};
+
+/// @brief How a changed file was brought into the destination directory, in order of preference
+enum struct Strategy {
+  // FICLONE, shares the underlying extents copy-on-write
+  Reflink,
+  // A full byte copy
+  Copy,
+  // Streamed into a sealed memfd, nothing is written to the destination
+  Memfd,
+};
+
+/// @brief Paths relative to a phase directory that should be treated as if they did not exist
+using Exclusions = std::unordered_set<std::string>;
+
+/// @brief Summary of the work done while staging a single phase
+struct PhaseStats {
+  size_t reflinked{};
+  size_t copied{};
+  size_t memfd{};
+  size_t removed{};
+  size_t unchanged{};
+  uint64_t bytes{};
+  std::chrono::nanoseconds elapsed{};
+
+  /// @brief The total number of files that were staged, regardless of strategy
+  [[nodiscard]] constexpr size_t staged() const noexcept {
+    return reflinked + copied + memfd;
+  }
+};
+
+/// @brief Brings dst in line with src, copying only files that were added or changed since the manifest was written
+/// and deleting files and directories that no longer exist in src. If nothing changed, no files are copied at all.
+/// Only source directories that changed since the manifest was written are listed, but every source file is still
+/// stat'ed, since a file rewritten in place leaves its directory untouched.
+/// Changed files are reflinked where the filesystem supports it, and copied otherwise. They are never hardlinked, the
+/// staged copy must not share an inode with the source the user can still modify.
+/// Every copy and the directory it was renamed into are synced before the copy is recorded in manifest.
+/// @param src The source phase directory
+/// @param dst The destination phase directory, must exist
+/// @param manifest The manifest for this phase, updated to reflect what was staged
+/// @param pool The workers to copy files on, many files are copied at once
+/// @param stats Filled with the amount of work done
+/// @param excluded Files in src that are not staged, and removed from dst if they were staged before
+/// @return true on success, false otherwise
+[[nodiscard]] bool stage_phase(std::filesystem::path const& src, std::filesystem::path const& dst,
+                               PhaseManifest& manifest, modloader::ThreadPool& pool, PhaseStats& stats,
+                               Exclusions const& excluded = {}) noexcept;
+
+/// @brief An object that was staged into a sealed memfd instead of the files dir
+struct MemfdObject {
+  int fd;
+  /// @brief The path to open the object through, /proc/self/fd/<fd>. On android, the object is dlopened through fd
+  /// itself instead.
+  std::filesystem::path procPath;
+  /// @brief The path the linker reports for the object once it is opened
+  std::string realpath;
+  /// @brief content_hash of the object, 0 when content hashing is disabled
+  uint64_t hash;
+};
+
+/// @brief Streams every .so in src, and every policy file, into its own sealed memfd, registered under the path it
+/// would have been copied to in dst. Nothing is written to dst. The memfds stay open for the lifetime of the process.
+/// @param src The source phase directory
+/// @param dst The destination phase directory the objects are registered under, need not exist
+/// @param pool The workers to stream files on
+/// @param stats Filled with the amount of work done
+/// @param excluded Files in src that are not staged
+/// @return true on success, false otherwise
+[[nodiscard]] bool stage_phase_memfd(std::filesystem::path const& src, std::filesystem::path const& dst,
+                                     modloader::ThreadPool& pool, PhaseStats& stats,
+                                     Exclusions const& excluded = {}) noexcept;
+
+/// @brief Returns true if objects were staged into memfds rather than to disk
+[[nodiscard]] bool memfd_staged() noexcept;
+
+/// @brief Finds the memfd the object at path was staged into
+/// @return The staged object, or nullptr if path was not staged into a memfd
+[[nodiscard]] MemfdObject const* find_memfd(std::filesystem::path const& path) noexcept;
+
+/// @brief The content hash the object at path was staged with, computed while it was being staged
+/// @return The hash, or nullopt if path was not staged or content hashing is disabled
+[[nodiscard]] std::optional<uint64_t> content_hash_of(std::filesystem::path const& path) noexcept;
+
+/// @brief The content hash of the object at path, if the bytes it was loaded from are known to have it: it was hashed
+/// while being staged into a memfd, or @ref verify_staged found its staged copy unchanged since it was hashed
+/// @return The hash, or nullopt if path was not staged with one or has not been verified yet
+[[nodiscard]] std::optional<uint64_t> verified_hash_of(std::filesystem::path const& path) noexcept;
+
+/// @brief Checks that the staged copy of an object still has the size, mtime and inode it had when the pass that
+/// wrote it hashed its bytes, so that its hash still describes it. Nothing is read: copies that were torn while being
+/// written already failed to stage. Objects without a recorded hash always pass. A changed object is removed, so that
+/// the next launch stages it again.
+/// @return true if the object may be loaded, false otherwise
+[[nodiscard]] bool verify_staged(std::filesystem::path const& path) noexcept;
+
+/// @brief Lists the paths of all memfd staged objects directly within dir, sorted
+[[nodiscard]] std::vector<std::filesystem::path> list_memfds(std::filesystem::path const& dir) noexcept;
+
+/// @brief The path to open the object at path through, which is its memfd if it was staged into one
+[[nodiscard]] inline std::filesystem::path const& open_path(std::filesystem::path const& path) noexcept {
+  auto const* memfd = find_memfd(path);
+  return memfd != nullptr ? memfd->procPath : path;
+}
+
+}  // namespace staging
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace modloader {
+
+/// @brief Identifies an interned string. Ids are small, dense and stable for the lifetime of the process.
+using StringId = uint32_t;
+
+/// @brief Hands out one id per distinct string, such as object paths and sonames, so that they can be compared and
+/// hashed as integers. Interned strings are never freed, views of them stay valid for the lifetime of the process.
+/// Thread safe.
+class StringInterner {
+ public:
+  /// @brief The id of value, interning it if it was not interned yet
+  [[nodiscard]] StringId intern(std::string_view value);
+  /// @brief The id of value, or nullopt if it was never interned
+  [[nodiscard]] std::optional<StringId> find(std::string_view value) const noexcept;
+  /// @brief The string id was handed out for
+  [[nodiscard]] std::string_view view(StringId id) const noexcept;
+
+  [[nodiscard]] size_t size() const noexcept;
+
+ private:
+  /// @brief The slot of value in table, or the empty slot it would be inserted into. Requires the lock.
+  [[nodiscard]] size_t locate(std::string_view value, size_t hash) const noexcept;
+  void grow();
+
+  mutable std::shared_mutex mutex;
+  // A deque, so that strings never move and views of them stay valid
+  std::deque<std::string> strings;
+  std::vector<size_t> hashes;
+  // Open addressing table of ids, with linear probing
+  std::vector<StringId> table;
+};
+
+/// @brief The interner shared by the whole process
+[[nodiscard]] StringInterner& get_interner() noexcept;
+
+/// @brief Interns path in the process wide interner
+[[nodiscard]] inline StringId intern_path(std::filesystem::path const& path) {
+  return get_interner().intern(path.native());
+}
+
+}  // namespace modloader
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dependency-graph.hpp"
+#include "elf-utils.hpp"
+#include "id-map.hpp"
+
+namespace modloader {
+
+/// @brief Checks, before an object is opened, that every symbol it requires is defined by an object it will be linked
+/// against. An object that would fail to open with RTLD_NOW can then be failed without mapping and relocating it, and
+/// with the exact symbols it is missing.
+/// Checks are conservative: whenever something cannot be read or looked up, the object is assumed to be fine.
+/// Not thread safe.
+class SymbolChecker {
+ public:
+  SymbolChecker() = default;
+  SymbolChecker(SymbolChecker const&) = delete;
+  SymbolChecker& operator=(SymbolChecker const&) = delete;
+  /// @brief Releases the handles taken on already loaded system libraries
+  ~SymbolChecker();
+
+  /// @brief Looks up every symbol id requires, at the version it requires it at, where the linker will: the global
+  /// group visible to dlsym(RTLD_DEFAULT), then its dependencies in graph, transitively.
+  /// Dependencies that are not in graph must already be loaded, they are looked up through dlsym.
+  /// @return The required symbols nothing defines, or nullopt if the object cannot be checked
+  [[nodiscard]] std::optional<std::vector<std::string>> missingSymbols(DependencyGraph const& graph,
+                                                                       DependencyGraph::NodeId id);
+
+ private:
+  /// @brief The symbol table of the object at path, read once. nullptr if it cannot be read.
+  elf_utils::SymbolTable const* tableOf(StringId id, std::filesystem::path const& path);
+  /// @brief A handle to the already loaded library name, taken once. nullptr if it is not loaded.
+  void* handleOf(StringId id, std::filesystem::path const& name);
+
+  IdMap<std::unique_ptr<elf_utils::SymbolTable>> tables;
+  IdMap<void*> handles;
+};
+
+}  // namespace modloader
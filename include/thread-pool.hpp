@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace modloader {
+
+/// @brief A small fixed-size pool of worker threads that run submitted tasks in FIFO order.
+/// Tasks must not throw.
+class ThreadPool {
+ public:
+  /// @brief Creates a pool with the provided number of workers, at least one worker is always created
+  explicit ThreadPool(size_t count);
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+  /// @brief Waits for all submitted tasks to finish, then joins all workers
+  ~ThreadPool();
+
+  /// @brief Queues a task to run on one of the workers
+  void submit(std::function<void()> task);
+  /// @brief Blocks until every task submitted so far has finished running
+  void wait();
+
+  [[nodiscard]] size_t size() const noexcept {
+    return workers.size();
+  }
+
+  /// @brief The worker count to use for I/O bound work, based on the number of cores available
+  [[nodiscard]] static size_t default_size() noexcept;
+  /// @brief The pool the loader scans and stages with, created with default_size workers on first use and kept for the
+  /// rest of the process. Its wait also waits for tasks other threads submitted, so its tasks must never wait on it.
+  [[nodiscard]] static ThreadPool& shared();
+
+ private:
+  void run();
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_available;
+  std::condition_variable idle;
+  size_t active = 0;
+  bool stopping = false;
+};
+
+}  // namespace modloader
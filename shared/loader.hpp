@@ -2,6 +2,7 @@
 #include "_config.h"
 
 #include <array>
+#include <cstdint>
 #include <deque>
 #include <filesystem>
 #include <new>
@@ -69,6 +70,35 @@ using LoadFunc = void (*)() noexcept;
 using LateLoadFunc = void (*)() noexcept;
 using UnloadFunc = void (*)() noexcept;
 
+/// @brief How the loader treats an object, read from the optional <name>.so.policy file next to it. The file holds one
+/// `key=value` pair per line, like the loader config. Objects without one get these defaults.
+struct LoadPolicy {
+  /// @brief bind=lazy: open with RTLD_LAZY instead of RTLD_NOW. Linkers that always bind on open, like bionic's, treat
+  /// both the same.
+  bool lazyBinding = false;
+  /// @brief priority: objects with a higher priority are opened first within their phase, ties keep file name order
+  int32_t priority = 0;
+  /// @brief thread_safe: setup and late_load may be called off the main thread, while mods it does not depend on are
+  /// set up at the same time. Such mods must not require other mods from setup.
+  bool threadSafe = false;
+  /// @brief deferred: a mod that is not opened with its phase, but the first time it is required, like the mods named
+  /// by the deferred_mods config key
+  bool deferred = false;
+  /// @brief async_late_load: late_load is called on a background worker after the other late_loads, once the late_loads
+  /// of the mods it depends on have finished. It must not touch Unity. Wait for it with await_late_loads.
+  bool asyncLateLoad = false;
+
+  [[nodiscard]] CLoadPolicy to_c() const noexcept {
+    return CLoadPolicy{
+      .lazy_binding = lazyBinding,
+      .priority = priority,
+      .thread_safe = threadSafe,
+      .deferred = deferred,
+      .async_late_load = asyncLateLoad,
+    };
+  }
+};
+
 struct SharedObject {
   std::filesystem::path path;
   explicit SharedObject(std::filesystem::path path) : path(std::move(path)) {}
@@ -80,17 +110,18 @@ struct SharedObject {
 
   /// @brief Returns a collection of dependency results for all of the dependencies of a SharedObject, as read from
   /// the ELF. Requires that the SharedObject is readable.
+  /// @deprecated The tree holds an object once for every path to it. It is built from the flat graph the loader
+  /// plans with on every call, whose nodes FailedMod::dependencyGraph exposes.
   /// @param dependencyDir The top level directory to load from
   /// @param phase The phase to start the reverse search from
-  /// @param loadedDependencies The dependecies that we have loaded already. The string_views must remain in lifetime
-  /// for the duration of this call.
+  /// @param loadedDependencies No longer filled, scanned objects are remembered by the loader instead
   /// @return The collection of dependency results that were attempted to be resolved
-  [[nodiscard]] std::vector<DependencyResult> getToLoad(
+  [[deprecated("build a flat graph instead")]] [[nodiscard]] std::vector<DependencyResult> getToLoad(
       std::filesystem::path const& dependencyDir, LoadPhase phase,
       std::unordered_map<std::string_view, std::vector<DependencyResult>>& loadedDependencies) const;
 
-  [[nodiscard]] std::vector<DependencyResult> getToLoad(std::filesystem::path const& dependencyDir,
-                                                        LoadPhase phase) const;
+  [[deprecated("build a flat graph instead")]] [[nodiscard]] std::vector<DependencyResult> getToLoad(
+      std::filesystem::path const& dependencyDir, LoadPhase phase) const;
 };
 
 struct Dependency {
@@ -108,11 +139,26 @@ struct Dependency {
   ~Dependency() = default;
 };
 
+/// @brief One object of a dependency graph that is stored flat, each object once
+struct DependencyNode {
+  SharedObject object;
+  // Whether no phase directory holds the object, so finding it was left to the linker
+  bool missing;
+  // The objects it needs, in the order it needs them, as indices into the graph it is part of
+  std::vector<uint32_t> needed;
+};
+
+/// @brief Builds the nested tree of the dependencies of the first node in nodes, for code written against the tree
+[[nodiscard]] std::vector<DependencyResult> dependencyTree(std::span<DependencyNode const> nodes);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 [[nodiscard]] inline std::vector<DependencyResult> SharedObject::getToLoad(std::filesystem::path const& dependencyDir,
                                                                            LoadPhase phase) const {
   std::unordered_map<std::string_view, std::vector<DependencyResult>> loadedDependencies{};
   return getToLoad(dependencyDir, phase, loadedDependencies);
 }
+#pragma GCC diagnostic pop
 
 enum struct MatchType {
   kStrict,
@@ -185,15 +231,22 @@ struct ModInfo {
 struct FailedMod {
   SharedObject object;
   std::string failure;
-  std::vector<DependencyResult> dependencies;
+  // The object and everything it depends on, transitively, each once. The first node is the object itself.
+  std::vector<DependencyNode> dependencyGraph;
 
   FailedMod(FailedMod&&) noexcept = default;
   FailedMod& operator=(FailedMod&&) noexcept = default;
   FailedMod(FailedMod const&) = delete;
   FailedMod& operator=(FailedMod const&) = delete;
 
-  FailedMod(SharedObject object, std::string failure, std::vector<DependencyResult> dependencies)
-      : object(std::move(object)), failure(std::move(failure)), dependencies(std::move(dependencies)) {}
+  FailedMod(SharedObject object, std::string failure, std::vector<DependencyNode> dependencyGraph)
+      : object(std::move(object)), failure(std::move(failure)), dependencyGraph(std::move(dependencyGraph)) {}
+
+  /// @brief The nested tree of the dependencies of the object, which FailedMod used to hold
+  /// @deprecated Built from dependencyGraph on every call, holding an object once for every path to it
+  [[deprecated("use dependencyGraph")]] [[nodiscard]] std::vector<DependencyResult> dependencies() const {
+    return dependencyTree(dependencyGraph);
+  }
 };
 
 struct LoadedMod {
@@ -343,8 +396,20 @@ struct MODLOADER_EXPORT ModData {
   }
 };
 
+/// @brief A DT_NEEDED cycle found while sorting: each object depends on the next, and the last one on the first
+struct DependencyCycle {
+  std::vector<std::filesystem::path> objects;
+};
+
+/// @brief Sorts dependencies such that each one comes after everything it depends on. Cycles are logged.
 std::deque<Dependency> MODLOADER_EXPORT topologicalSort(std::span<DependencyResult const> list);
 std::deque<Dependency> MODLOADER_EXPORT topologicalSort(std::vector<Dependency>&& list);
+/// @brief Sorts dependencies such that each one comes after everything it depends on.
+/// Every cycle found is appended to cycles instead of being logged.
+std::deque<Dependency> MODLOADER_EXPORT topologicalSort(std::span<DependencyResult const> list,
+                                                        std::vector<DependencyCycle>& cycles);
+std::deque<Dependency> MODLOADER_EXPORT topologicalSort(std::vector<Dependency>&& list,
+                                                        std::vector<DependencyCycle>& cycles);
 
 /// @brief Triggers an unload of the specified mod, which will in turn call the unload() method of it.
 /// It will also be removed from any collections. It is UB if the mod to be unloaded is the currently executing mod.
@@ -359,6 +424,27 @@ MODLOADER_EXPORT std::vector<ModData> get_loaded() noexcept;
 /// Gets all loaded libs, early mods, and mods and returns the ModResult types.
 MODLOADER_EXPORT std::vector<ModResult> get_all() noexcept;
 
+/// @brief Gets the content hash of a staged object, as computed while it was staged. Suitable as a cache key for
+/// anything derived from the object's contents.
+/// @param path The path of the object, as found in ModData::path
+/// @return The hash, or nullopt if the object was not staged by the modloader or content hashing is disabled
+MODLOADER_EXPORT std::optional<uint64_t> get_content_hash(std::filesystem::path const& path) noexcept;
+/// @brief Opens a mod deferred by the deferred_mods config key, along with everything it depends on, and calls its
+/// setup. A deferred mod is also opened the first time it is required or looked up.
+/// @param name The file name of the mod, e.g. libexample.so
+/// @return The result of the mod, or nullopt if no deferred mod is called name
+MODLOADER_EXPORT std::optional<ModResult> open_deferred(std::string_view name) noexcept;
+/// Gets the paths of all deferred mods that have not been opened yet
+MODLOADER_EXPORT std::vector<std::filesystem::path> get_deferred() noexcept;
+/// @brief The load policy in effect for an object, the defaults if it has no policy file
+/// @param path The path of the object, as found in ModData::path
+MODLOADER_EXPORT LoadPolicy get_policy(std::filesystem::path const& path) noexcept;
+/// @brief Blocks until the late_loads of mods with the async_late_load policy have finished. Call before relying on
+/// anything those mods set up. Returns right away when called from inside one of them.
+MODLOADER_EXPORT void await_late_loads() noexcept;
+/// Whether the late_loads of mods with the async_late_load policy have finished, without blocking
+MODLOADER_EXPORT bool late_loads_finished() noexcept;
+
 }  // namespace modloader
 
 #ifdef MODLOADER_USE_FMT
@@ -82,6 +82,14 @@ typedef struct {
   size_t size;
 } CLoadResults;
 
+typedef struct {
+  bool lazy_binding;
+  int32_t priority;
+  bool thread_safe;
+  bool deferred;
+  bool async_late_load;
+} CLoadPolicy;
+
 #ifdef __cplusplus
 }
 #endif
@@ -138,12 +146,32 @@ MODLOADER_FUNC CModResults modloader_get_loaded();
 MODLOADER_FUNC CLoadResults modloader_get_all();
 /// @brief Frees a CModResults object
 MODLOADER_FUNC void modloader_free_results(CModResults* results);
+/// @brief Gets the content hash of a staged object, as computed while it was staged.
+/// Suitable as a cache key for anything derived from the object's contents.
+/// @param path The path of the object, as returned in CModResult::path
+/// @param hash Filled with the hash on success
+/// @return true if the object was staged with a hash, false otherwise
+MODLOADER_FUNC bool modloader_get_content_hash(char const* path, uint64_t* hash);
+/// @brief Gets the load policy in effect for an object, as read from its <name>.so.policy file when it was listed.
+/// Objects without a policy file have the default policy.
+/// @param path The path of the object, as returned in CModResult::path
+/// @param policy Filled with the policy
+/// @return true on success, false if either argument is null
+MODLOADER_FUNC bool modloader_get_policy(char const* path, CLoadPolicy* policy);
 /// @brief Returns an allocated array of CModResults for all successfully loaded objects.
 /// @return LoadResult describing the action
 MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType match_type);
 /// @brief Adds the path to the LD_LIBRARY_PATH of the modloader/mods namespace
 /// @return If it could add the path or not
 MODLOADER_FUNC bool modloader_add_ld_library_path(char const* path);
+/// @brief Opens a deferred mod by its file name, e.g. libexample.so, see modloader::open_deferred
+/// @return MatchType_Loaded if the mod is open, LoadResult_Failed if it failed to open, LoadResult_NotFound if no
+/// deferred mod is called name
+MODLOADER_FUNC CLoadResultEnum modloader_open_deferred(char const* name);
+/// @brief Blocks until the late_loads running in the background have finished, see modloader::await_late_loads
+MODLOADER_FUNC void modloader_await_late_loads();
+/// @brief Whether the late_loads running in the background have finished, without blocking
+MODLOADER_FUNC bool modloader_late_loads_finished();
 // TODO: More docs on existing
 // TODO: Improve version_long to be more descriptive, potentially 3 or more fields?
 // - CAPI will need more effort here, we need to copy over
@@ -0,0 +1,171 @@
+#include "config.hpp"
+#include "id-map.hpp"
+#include "log.h"
+#include "staging.hpp"
+#include "string-interner.hpp"
+
+#include <charconv>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+bool parse_bool(std::string_view value) {
+  return value == "1" || value == "true" || value == "yes" || value == "on";
+}
+
+std::vector<std::string> parse_list(std::string_view value) {
+  std::vector<std::string> items{};
+  while (!value.empty()) {
+    auto idx = value.find(',');
+    auto item = value.substr(0, idx);
+    if (!item.empty()) {
+      items.emplace_back(item);
+    }
+    value = idx == std::string_view::npos ? std::string_view{} : value.substr(idx + 1);
+  }
+  return items;
+}
+
+template <typename T>
+std::optional<T> parse_number(std::string_view value) {
+  T result{};
+  auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+  if (error != std::errc{} || end != value.data() + value.size()) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+}  // namespace
+
+namespace modloader {
+
+namespace {
+
+/// @brief Calls apply with every `key=value` pair in the file at path, logging the pairs it applied
+/// @param what What the file is, for logging
+/// @param apply Returns false if it ignored the pair, after logging why
+template <typename F>
+bool read_pairs(std::filesystem::path const& path, std::string const& what, F&& apply) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::string_view view(line);
+    if (view.empty() || view.front() == '#') {
+      continue;
+    }
+    auto idx = view.find('=');
+    if (idx == std::string_view::npos) {
+      LOG_WARN("Ignoring malformed line in {}: {}", what.c_str(), line.c_str());
+      continue;
+    }
+    auto key = view.substr(0, idx);
+    auto value = view.substr(idx + 1);
+    if (apply(key, value)) {
+      LOG_INFO("Read {}: {} = {}", what.c_str(), std::string(key).c_str(), std::string(value).c_str());
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+LoaderConfig LoaderConfig::read(std::filesystem::path const& path) noexcept {
+  LoaderConfig config{};
+  auto found = read_pairs(path, "loader config", [&config](std::string_view key, std::string_view value) {
+    if (key == "memfd_staging") {
+      config.memfdStaging = parse_bool(value);
+    } else if (key == "content_hashing") {
+      config.contentHashing = parse_bool(value);
+    } else if (key == "prune_libs") {
+      config.pruneLibs = parse_bool(value);
+    } else if (key == "verify_symbols") {
+      config.verifySymbols = parse_bool(value);
+    } else if (key == "prefetch_budget") {
+      auto budget = parse_number<uint64_t>(value);
+      if (!budget) {
+        LOG_WARN("Ignoring malformed loader config value: {}", std::string(value).c_str());
+        return false;
+      }
+      config.prefetchBudget = *budget;
+    } else if (key == "deferred_mods") {
+      config.deferredMods = parse_list(value);
+    } else if (key == "failure_cache") {
+      config.failureCache = parse_bool(value);
+    } else {
+      LOG_WARN("Ignoring unknown loader config key: {}", std::string(key).c_str());
+      return false;
+    }
+    return true;
+  });
+  if (!found) {
+    LOG_DEBUG("No loader config at: {}, using defaults", path.c_str());
+  }
+  return config;
+}
+
+LoaderConfig& get_config() noexcept {
+  static LoaderConfig config{};
+  return config;
+}
+
+LoadPolicy read_policy(std::filesystem::path const& path) noexcept {
+  LoadPolicy policy{};
+  auto policy_path = path;
+  policy_path += kPolicySuffix;
+  // Policy files are staged along with their object, into a memfd if it was
+  auto what = "policy of " + path.filename().string();
+  read_pairs(staging::open_path(policy_path), what, [&](std::string_view key, std::string_view value) {
+    if (key == "bind") {
+      if (value != "lazy" && value != "now") {
+        LOG_WARN("Ignoring malformed bind mode: {} in policy of: {}", std::string(value).c_str(), path.c_str());
+        return false;
+      }
+      policy.lazyBinding = value == "lazy";
+    } else if (key == "priority") {
+      auto priority = parse_number<int32_t>(value);
+      if (!priority) {
+        LOG_WARN("Ignoring malformed priority: {} in policy of: {}", std::string(value).c_str(), path.c_str());
+        return false;
+      }
+      policy.priority = *priority;
+    } else if (key == "thread_safe") {
+      policy.threadSafe = parse_bool(value);
+    } else if (key == "deferred") {
+      policy.deferred = parse_bool(value);
+    } else if (key == "async_late_load") {
+      policy.asyncLateLoad = parse_bool(value);
+    } else {
+      LOG_WARN("Ignoring unknown key: {} in policy of: {}", std::string(key).c_str(), path.c_str());
+      return false;
+    }
+    return true;
+  });
+  return policy;
+}
+
+LoadPolicy policy_of(std::filesystem::path const& path) noexcept {
+  static std::mutex mutex;
+  // Interned path to the policy read for it
+  static IdMap<LoadPolicy> policies;
+  auto id = intern_path(path);
+  {
+    std::unique_lock lock(mutex);
+    if (auto const* found = policies.find(id)) {
+      return *found;
+    }
+  }
+  auto policy = read_policy(path);
+  std::unique_lock lock(mutex);
+  return *policies.try_emplace(id, policy).first;
+}
+
+}  // namespace modloader
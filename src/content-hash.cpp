@@ -0,0 +1,166 @@
+#include "content-hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr uint64_t kPrime32 = 0x9E3779B1ULL;
+constexpr uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime64_3 = 0x165667B19E3779F9ULL;
+constexpr size_t kKeySize = 192;
+
+/// @brief The key mixed into every stripe, derived from splitmix64 so it needs no hand written table
+constexpr std::array<uint8_t, kKeySize> make_key() {
+  std::array<uint8_t, kKeySize> key{};
+  uint64_t state = kPrime64_3;
+  for (size_t i = 0; i < kKeySize; i += sizeof(uint64_t)) {
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    for (size_t b = 0; b < sizeof(uint64_t); b++) {
+      key[i + b] = static_cast<uint8_t>(z >> (b * 8));
+    }
+  }
+  return key;
+}
+constexpr auto kKey = make_key();
+
+inline uint64_t read64(uint8_t const* ptr) {
+  uint64_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+/// @brief acc[i ^ 1] += data[i], acc[i] += lo32(data[i] ^ key[i]) * hi32(data[i] ^ key[i]) for all 8 lanes
+inline void accumulate(uint64_t* acc, uint8_t const* data, uint8_t const* key) {
+#if defined(__ARM_NEON)
+  for (size_t i = 0; i < 4; i++) {
+    auto data_vec = vreinterpretq_u64_u8(vld1q_u8(data + i * 16));
+    auto key_vec = vreinterpretq_u64_u8(vld1q_u8(key + i * 16));
+    auto data_key = veorq_u64(data_vec, key_vec);
+    auto sum = vaddq_u64(vld1q_u64(acc + i * 2), vextq_u64(data_vec, data_vec, 1));
+    sum = vmlal_u32(sum, vmovn_u64(data_key), vshrn_n_u64(data_key, 32));
+    vst1q_u64(acc + i * 2, sum);
+  }
+#elif defined(__SSE2__)
+  for (size_t i = 0; i < 4; i++) {
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto data_vec = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i * 16));
+    auto key_vec = _mm_loadu_si128(reinterpret_cast<__m128i const*>(key + i * 16));
+    auto data_key = _mm_xor_si128(data_vec, key_vec);
+    auto product = _mm_mul_epu32(data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1)));
+    auto swapped = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+    auto* lanes = reinterpret_cast<__m128i*>(acc + i * 2);
+    _mm_store_si128(lanes, _mm_add_epi64(_mm_load_si128(lanes), _mm_add_epi64(product, swapped)));
+    // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+  }
+#else
+  for (size_t i = 0; i < 8; i++) {
+    auto data_val = read64(data + i * 8);
+    auto data_key = data_val ^ read64(key + i * 8);
+    acc[i ^ 1] += data_val;
+    acc[i] += (data_key & 0xFFFFFFFFULL) * (data_key >> 32);
+  }
+#endif
+}
+
+/// @brief Keeps the accumulators from saturating, run once per block
+inline void scramble(uint64_t* acc, uint8_t const* key) {
+  for (size_t i = 0; i < 8; i++) {
+    auto value = acc[i];
+    value ^= value >> 47;
+    value ^= read64(key + i * 8);
+    acc[i] = value * kPrime32;
+  }
+}
+
+__extension__ using uint128_t = unsigned __int128;
+
+inline uint64_t mul_fold(uint64_t lhs, uint64_t rhs) {
+  auto product = static_cast<uint128_t>(lhs) * rhs;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+inline uint64_t avalanche(uint64_t hash) {
+  hash ^= hash >> 37;
+  hash *= 0x165667919E3779F9ULL;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+}  // namespace
+
+namespace content_hash {
+
+Hasher::Hasher() noexcept
+    : acc{ kPrime32, kPrime64_1, kPrime64_2, kPrime64_3, kPrime64_1 ^ kPrime64_2, kPrime64_2 ^ kPrime64_3,
+           kPrime64_3 ^ kPrime32, kPrime64_1 ^ kPrime32 } {}
+
+void Hasher::consume_stripe(uint8_t const* stripe) noexcept {
+  accumulate(acc.data(), stripe, kKey.data() + stripesInBlock * sizeof(uint64_t));
+  if (++stripesInBlock == kStripesPerBlock) {
+    scramble(acc.data(), kKey.data() + kKeySize - kStripeSize);
+    stripesInBlock = 0;
+  }
+}
+
+void Hasher::update(std::span<uint8_t const> bytes) noexcept {
+  if (bytes.empty()) {
+    return;
+  }
+  total += bytes.size();
+  auto const* data = bytes.data();
+  auto remaining = bytes.size();
+  if (pendingSize != 0) {
+    auto amount = std::min(remaining, kStripeSize - pendingSize);
+    std::memcpy(pending.data() + pendingSize, data, amount);
+    pendingSize += amount;
+    data += amount;
+    remaining -= amount;
+    if (pendingSize < kStripeSize) {
+      return;
+    }
+    consume_stripe(pending.data());
+    pendingSize = 0;
+  }
+  // Hot loop: whole stripes straight out of the caller's buffer
+  for (; remaining >= kStripeSize; remaining -= kStripeSize, data += kStripeSize) {
+    consume_stripe(data);
+  }
+  std::memcpy(pending.data(), data, remaining);
+  pendingSize = remaining;
+}
+
+uint64_t Hasher::finish() const noexcept {
+  alignas(16) auto state = acc;
+  if (pendingSize != 0) {
+    // The zero padding is disambiguated by mixing in the total length below
+    std::array<uint8_t, kStripeSize> last{};
+    std::memcpy(last.data(), pending.data(), pendingSize);
+    accumulate(state.data(), last.data(), kKey.data() + kKeySize - kStripeSize - 7);
+  }
+  uint64_t result = total * kPrime64_1;
+  for (size_t i = 0; i < 4; i++) {
+    result += mul_fold(state[i * 2] ^ read64(kKey.data() + 11 + i * 16),
+                       state[i * 2 + 1] ^ read64(kKey.data() + 11 + i * 16 + 8));
+  }
+  return avalanche(result);
+}
+
+uint64_t hash(std::span<uint8_t const> bytes) noexcept {
+  Hasher hasher{};
+  hasher.update(bytes);
+  return hasher.finish();
+}
+
+}  // namespace content_hash
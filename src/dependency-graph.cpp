@@ -0,0 +1,252 @@
+#include "dependency-graph.hpp"
+#include "elf-metadata.hpp"
+#include "internal-loader.hpp"
+#include "log.h"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace modloader {
+
+namespace {
+
+ScannedObject scanObject(std::filesystem::path const& path, std::filesystem::path const& dependencyDir,
+                         LoadPhase phase) {
+  auto metadata = elf_metadata::get(path);
+  if (!metadata) {
+    return ScannedObject{ .readable = false, .needed = {}, .lifecycle = {} };
+  }
+  ScannedObject scanned{ .readable = true, .needed = {}, .lifecycle = metadata->lifecycle };
+  scanned.needed.reserve(metadata->needed.size());
+  for (auto const& name : metadata->needed) {
+    auto optObj = findSharedObject(dependencyDir, phase, name);
+    if (!optObj) {
+      // Failed dependency (failed to check if it exists?)
+      LOG_WARN("Skipping FAILED dependency: {}", name.c_str());
+      continue;
+    }
+    scanned.needed.emplace_back(std::move(optObj->first.path), optObj->second);
+  }
+  return scanned;
+}
+
+// Every object scanned since the memo was last cleared, keyed by interned path. Entries are only removed all at once by
+// clearScanned, and the deque never moves them, so references to them stay valid until then.
+std::mutex scanned_mutex;
+std::deque<ScannedObject> scanned_storage;
+IdMap<ScannedObject const*> scanned_objects;
+
+}  // namespace
+
+ScannedObject const& getScanned(std::filesystem::path const& path, std::filesystem::path const& dependencyDir,
+                                LoadPhase phase) {
+  auto id = intern_path(path);
+  {
+    std::unique_lock lock(scanned_mutex);
+    if (auto const* found = scanned_objects.find(id)) {
+      return **found;
+    }
+  }
+  auto scanned = scanObject(path, dependencyDir, phase);
+  std::unique_lock lock(scanned_mutex);
+  // Another thread may have scanned it in the meantime, in which case both results are identical
+  if (auto const* found = scanned_objects.find(id)) {
+    return **found;
+  }
+  auto const& stored = scanned_storage.emplace_back(std::move(scanned));
+  scanned_objects.try_emplace(id, &stored);
+  return stored;
+}
+
+void clearScanned() noexcept {
+  std::unique_lock lock(scanned_mutex);
+  LOG_DEBUG("Dropping: {} scanned objects", scanned_storage.size());
+  scanned_objects.clear();
+  scanned_storage.clear();
+}
+
+void prescanDependencies(std::span<SharedObject const> roots, std::filesystem::path const& dependencyDir,
+                         LoadPhase phase, ThreadPool& pool) {
+  auto start = std::chrono::steady_clock::now();
+  std::mutex mutex;
+  IdSet queued{};
+  // Objects are scanned as soon as they are discovered, the pool is drained once nothing new turns up
+  std::function<void(std::filesystem::path const&, LoadPhase)> enqueue = [&](std::filesystem::path const& path,
+                                                                            LoadPhase objectPhase) {
+    {
+      std::unique_lock lock(mutex);
+      if (!queued.insert(intern_path(path))) {
+        return;
+      }
+    }
+    pool.submit([&enqueue, &dependencyDir, path, objectPhase] {
+      for (auto const& [depPath, depPhase] : getScanned(path, dependencyDir, objectPhase).needed) {
+        if (depPhase != LoadPhase::None) {
+          enqueue(depPath, depPhase);
+        }
+      }
+    });
+  };
+  for (auto const& root : roots) {
+    enqueue(root.path, phase);
+  }
+  pool.wait();
+  LOG_DEBUG("Scanned: {} objects for phase: {} with: {} workers in {}us", queued.size(), phase, pool.size(),
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+DependencyGraph::NodeId DependencyGraph::intern(std::filesystem::path const& path, LoadPhase phase) {
+  auto pathId = intern_path(path);
+  auto [node, added] = ids.try_emplace(pathId, static_cast<NodeId>(phases.size()));
+  if (added) {
+    paths.emplace_back(path);
+    pathIds.push_back(pathId);
+    phases.push_back(phase);
+  }
+  return *node;
+}
+
+DependencyGraph DependencyGraph::build(std::span<SharedObject const> roots, std::filesystem::path const& dependencyDir,
+                                       LoadPhase phase, std::pmr::memory_resource* resource) {
+  DependencyGraph graph(resource);
+  for (auto const& root : roots) {
+    graph.intern(root.path, phase);
+  }
+  graph.roots = graph.size();
+  // Nodes are visited in id order, so the edges of each node are appended right after those of the previous one
+  graph.edgeOffsets.push_back(0);
+  for (NodeId id = 0; id < graph.size(); id++) {
+    ScannedObject const* scanned = nullptr;
+    if (!graph.missing(id)) {
+      scanned = &getScanned(graph.paths[id], dependencyDir, graph.phases[id]);
+      for (auto const& [depPath, depPhase] : scanned->needed) {
+        graph.edges.push_back(graph.intern(depPath, depPhase));
+      }
+    }
+    graph.scannedObjects.push_back(scanned);
+    graph.edgeOffsets.push_back(static_cast<uint32_t>(graph.edges.size()));
+  }
+  graph.sortedEdgeOffsets.reserve(graph.edgeOffsets.size());
+  graph.sortedEdges.reserve(graph.edges.size());
+  graph.sortedEdgeOffsets.push_back(0);
+  for (NodeId id = 0; id < graph.size(); id++) {
+    auto begin = graph.sortedEdges.size();
+    for (auto dep : graph.dependencies(id)) {
+      if (!graph.missing(dep)) {
+        graph.sortedEdges.push_back(dep);
+      }
+    }
+    std::stable_sort(graph.sortedEdges.begin() + static_cast<ptrdiff_t>(begin), graph.sortedEdges.end(),
+                     [&graph](NodeId a, NodeId b) { return graph.paths[a].native() > graph.paths[b].native(); });
+    graph.sortedEdgeOffsets.push_back(static_cast<uint32_t>(graph.sortedEdges.size()));
+  }
+  LOG_DEBUG("Built dependency graph for phase: {} with: {} nodes and: {} edges", phase, graph.size(),
+            graph.edgeCount());
+  return graph;
+}
+
+std::optional<DependencyGraph::NodeId> DependencyGraph::find(std::string_view path) const noexcept {
+  auto pathId = get_interner().find(path);
+  if (!pathId) {
+    return std::nullopt;
+  }
+  auto const* id = ids.find(*pathId);
+  if (id == nullptr) {
+    return std::nullopt;
+  }
+  return *id;
+}
+
+std::pmr::vector<DependencyGraph::NodeId> DependencyGraph::loadOrder(NodeId id,
+                                                                    std::vector<std::vector<NodeId>>* cycles) const {
+  std::pmr::vector<NodeId> order(resource());
+  std::pmr::vector<Mark> marks(size(), Mark::None, resource());
+  WalkStack stack(resource());
+  walk(id, marks, order, stack, cycles);
+  return order;
+}
+
+DependencyGraph::Plan DependencyGraph::plan() const {
+  Plan plan{ .groups = std::pmr::vector<Plan::Group>(resource()),
+             .steps = std::pmr::vector<NodeId>(resource()),
+             .cycles = {} };
+  plan.groups.reserve(roots);
+  // Every node is walked at most once, so this is the only allocation steps needs
+  plan.steps.reserve(size());
+  std::pmr::vector<Mark> marks(size(), Mark::None, resource());
+  WalkStack stack(resource());
+  for (NodeId root = 0; root < roots; root++) {
+    auto begin = static_cast<uint32_t>(plan.steps.size());
+    walk(root, marks, plan.steps, stack, &plan.cycles);
+    plan.groups.push_back(Plan::Group{ .root = root, .begin = begin, .end = static_cast<uint32_t>(plan.steps.size()) });
+    // The root is opened right after its dependencies, so later roots must not walk it again
+    if (marks[root] == Mark::None) {
+      marks[root] = Mark::Done;
+    }
+  }
+  return plan;
+}
+
+void DependencyGraph::walk(NodeId id, std::pmr::vector<Mark>& marks, std::pmr::vector<NodeId>& order,
+                           WalkStack& stack, std::vector<std::vector<NodeId>>* cycles) const {
+  // The same walk topologicalSort does over trees: children in descending path order, each node after its children
+  for (auto start : sortedDependencies(id)) {
+    if (marks[start] != Mark::None) {
+      continue;
+    }
+    marks[start] = Mark::Active;
+    stack.emplace_back(start, 0);
+    while (!stack.empty()) {
+      auto [node, next] = stack.back();
+      auto children = sortedDependencies(node);
+      if (next == children.size()) {
+        marks[node] = Mark::Done;
+        order.push_back(node);
+        stack.pop_back();
+        continue;
+      }
+      stack.back().second++;
+      auto child = children[next];
+      if (marks[child] == Mark::None) {
+        marks[child] = Mark::Active;
+        stack.emplace_back(child, 0);
+      } else if (marks[child] == Mark::Active && cycles != nullptr) {
+        auto& cycle = cycles->emplace_back();
+        auto it = std::find_if(stack.begin(), stack.end(), [child](auto const& entry) { return entry.first == child; });
+        for (; it != stack.end(); ++it) {
+          cycle.push_back(it->first);
+        }
+      }
+    }
+  }
+}
+
+std::vector<DependencyNode> DependencyGraph::nodesOf(NodeId id) const {
+  constexpr auto kUnvisited = ~uint32_t{};
+  std::vector<uint32_t> indices(size(), kUnvisited);
+  indices[id] = 0;
+  std::vector<NodeId> order{ id };
+  std::vector<DependencyNode> nodes{};
+  for (size_t i = 0; i < order.size(); i++) {
+    auto node = order[i];
+    std::vector<uint32_t> needed{};
+    needed.reserve(dependencies(node).size());
+    for (auto dep : dependencies(node)) {
+      if (indices[dep] == kUnvisited) {
+        indices[dep] = static_cast<uint32_t>(order.size());
+        order.push_back(dep);
+      }
+      needed.push_back(indices[dep]);
+    }
+    nodes.push_back(DependencyNode{ .object = SharedObject(paths[node]), .missing = missing(node), .needed = needed });
+  }
+  return nodes;
+}
+
+}  // namespace modloader
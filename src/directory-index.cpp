@@ -0,0 +1,136 @@
+#include "directory-index.hpp"
+#include "log.h"
+#include "staging.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+struct DirCloser {
+  void operator()(DIR* dir) const noexcept {
+    if (closedir(dir) != 0) {
+      LOG_WARN("Failed to close directory: {}", std::strerror(errno));
+    }
+  }
+};
+
+std::mutex indices_mutex;
+std::unordered_map<std::string, std::shared_ptr<modloader::DirectoryIndex const>> indices;
+
+}  // namespace
+
+namespace modloader {
+
+void DirectoryIndex::add(LoadPhase phase, std::filesystem::path path, ino_t inode, bool directory) {
+  byName.try_emplace(get_interner().intern(path.filename().native())).first->push_back(files.size());
+  files.push_back(IndexedFile{ .phase = phase, .path = std::move(path), .inode = inode, .directory = directory });
+}
+
+DirectoryIndex DirectoryIndex::build(std::filesystem::path const& root) noexcept {
+  DirectoryIndex index{};
+  // Phases are added in load phase order, which keeps every byName entry in search order
+  for (auto const& [phase, path] : loadPhaseMap.arr) {
+    auto dir_path = root / path;
+    if (staging::memfd_staged()) {
+      // Nothing was written to disk, so index what was staged into memory instead
+      for (auto& staged : staging::list_memfds(dir_path)) {
+        index.add(phase, std::move(staged), 0, false);
+      }
+      continue;
+    }
+    std::unique_ptr<DIR, DirCloser> dir(opendir(dir_path.c_str()));
+    if (!dir) {
+      if (errno == ENOENT) {
+        LOG_DEBUG("No directory for phase: {} at: {}", phase, dir_path.c_str());
+      } else {
+        LOG_ERROR("Failed to open directory for phase: {} at: {}: {}", phase, dir_path.c_str(), std::strerror(errno));
+      }
+      continue;
+    }
+    errno = 0;
+    while (auto const* entry = readdir(dir.get())) {
+      std::string_view name(entry->d_name);
+      if (name == "." || name == "..") {
+        continue;
+      }
+      auto type = entry->d_type;
+      if (type == DT_LNK || type == DT_UNKNOWN) {
+        // Only these need a stat, to find out what they actually are. Dangling links are treated as absent.
+        struct stat64 st {};
+        if (fstatat64(dirfd(dir.get()), entry->d_name, &st, 0) != 0) {
+          LOG_WARN("Failed to stat: {} in: {}, skipping it: {}", entry->d_name, dir_path.c_str(),
+                   std::strerror(errno));
+          errno = 0;
+          continue;
+        }
+        type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+      }
+      index.add(phase, dir_path / name, entry->d_ino, type == DT_DIR);
+    }
+    if (errno != 0) {
+      LOG_ERROR("Failed while reading directory for phase: {} at: {}: {}", phase, dir_path.c_str(),
+                std::strerror(errno));
+    }
+  }
+  LOG_DEBUG("Indexed {} files under: {}", index.files.size(), root.c_str());
+  return index;
+}
+
+IndexedFile const* DirectoryIndex::find(LoadPhase phase, std::string_view name) const noexcept {
+  // Names that were never interned cannot be in the index
+  auto id = get_interner().find(name);
+  auto const* indices = id ? byName.find(*id) : nullptr;
+  if (indices == nullptr) {
+    return nullptr;
+  }
+  for (auto idx : *indices) {
+    auto const& file = files[idx];
+    if (static_cast<int>(file.phase) > static_cast<int>(phase) && file.phase != LoadPhase::Shim) {
+      continue;
+    }
+    return &file;
+  }
+  return nullptr;
+}
+
+std::vector<IndexedFile const*> DirectoryIndex::list(LoadPhase phase) const noexcept {
+  std::vector<IndexedFile const*> result{};
+  for (auto const& file : files) {
+    if (file.phase == phase) {
+      result.push_back(&file);
+    }
+  }
+  return result;
+}
+
+std::shared_ptr<DirectoryIndex const> get_directory_index(std::filesystem::path const& root) noexcept {
+  std::unique_lock lock(indices_mutex);
+  auto& index = indices[root.string()];
+  if (!index) {
+    index = std::make_shared<DirectoryIndex const>(DirectoryIndex::build(root));
+  }
+  return index;
+}
+
+void invalidate_directory_indices() noexcept {
+  std::unique_lock lock(indices_mutex);
+  indices.clear();
+}
+
+void invalidate_directory_index_of(std::filesystem::path const& path) noexcept {
+  std::unique_lock lock(indices_mutex);
+  // Indexed files live directly under a phase directory of their root
+  auto root = path.parent_path().parent_path();
+  if (indices.erase(root.string()) != 0) {
+    LOG_DEBUG("Dropped the directory index of: {} after: {} was removed", root.c_str(), path.c_str());
+  }
+}
+
+}  // namespace modloader
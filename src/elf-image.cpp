@@ -0,0 +1,109 @@
+#include "elf-image.hpp"
+#include "id-map.hpp"
+#include "log.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+struct ImageCache {
+  std::mutex mutex;
+  // Interned path to the image last mapped for it
+  modloader::IdMap<std::shared_ptr<modloader::ElfImage const>> images;
+};
+
+ImageCache& get_cache() {
+  static ImageCache cache;
+  return cache;
+}
+
+/// @brief Whether count entries of entry_size bytes at offset lie within a file of size bytes
+bool in_bounds(uint64_t size, uint64_t offset, uint64_t count, uint64_t entry_size) {
+  return offset <= size && (entry_size == 0 || count <= (size - offset) / entry_size);
+}
+
+}  // namespace
+
+namespace modloader {
+
+std::shared_ptr<ElfImage const> ElfImage::open(std::filesystem::path const& path) noexcept {
+  auto& cache = get_cache();
+  auto id = intern_path(path);
+  auto const& file = staging::open_path(path);
+
+  UniqueFd fd(open64(file.c_str(), O_RDONLY | O_CLOEXEC));
+  struct stat64 st {};
+  if (fd.fd == -1 || fstat64(fd.fd, &st) != 0) {
+    LOG_ERROR("Failed to open: {} to map it: {}", path.c_str(), std::strerror(errno));
+    return nullptr;
+  }
+  auto identity = staging::identity_of(st);
+  {
+    std::unique_lock lock(cache.mutex);
+    if (auto const* found = cache.images.find(id); found != nullptr && (*found)->identity().same_identity(identity)) {
+      return *found;
+    }
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+  std::shared_ptr<ElfImage const> image(new ElfImage(path, identity, fd.fd, static_cast<size_t>(st.st_size)));
+  if (!image->mapping.valid()) {
+    LOG_ERROR("Failed to map: {}: {}", path.c_str(), std::strerror(errno));
+    return nullptr;
+  }
+  if (!image->validate()) {
+    LOG_ERROR("Not a valid 64 bit ELF: {}", path.c_str());
+    return nullptr;
+  }
+  LOG_DEBUG("Mapped: {} bytes of: {}", st.st_size, path.c_str());
+
+  std::unique_lock lock(cache.mutex);
+  auto [slot, inserted] = cache.images.try_emplace(id, image);
+  if (!inserted) {
+    // Another thread may have mapped the same file meanwhile, keep whichever is current
+    if ((*slot)->identity().same_identity(identity)) {
+      return *slot;
+    }
+    *slot = image;
+  }
+  return image;
+}
+
+void ElfImage::clearCache() noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  LOG_DEBUG("Dropping: {} cached ELF images", cache.images.size());
+  cache.images.clear();
+}
+
+bool ElfImage::validate() const noexcept {
+  auto file = bytes();
+  if (file.size() < sizeof(Elf64_Ehdr)) {
+    return false;
+  }
+  auto const& elf = header();
+  if (std::memcmp(elf.e_ident, ELFMAG, SELFMAG) != 0 || elf.e_ident[EI_CLASS] != ELFCLASS64) {
+    return false;
+  }
+  if (elf.e_phnum != 0 && (elf.e_phentsize < sizeof(Elf64_Phdr) ||
+                           !in_bounds(file.size(), elf.e_phoff, elf.e_phnum, elf.e_phentsize))) {
+    return false;
+  }
+  return elf.e_shnum == 0 ||
+         (elf.e_shentsize >= sizeof(Elf64_Shdr) && in_bounds(file.size(), elf.e_shoff, elf.e_shnum, elf.e_shentsize));
+}
+
+std::optional<elf_utils::DynamicReader> ElfImage::dynamic() const noexcept {
+  return elf_utils::DynamicReader::open(bytes());
+}
+
+elf_utils::SymbolLookup const* ElfImage::symbols() const noexcept {
+  std::call_once(symbolsBuilt, [this] { lookup = elf_utils::SymbolLookup::create(bytes()); });
+  return lookup ? &*lookup : nullptr;
+}
+
+}  // namespace modloader
@@ -0,0 +1,263 @@
+#include "elf-metadata.hpp"
+#include "elf-utils.hpp"
+#include "log.h"
+#include "staging.hpp"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+struct CacheEntry {
+  staging::FileRecord identity;
+  elf_metadata::Metadata metadata;
+  // Whether the object was looked up during this launch, only those are persisted
+  bool used;
+};
+
+struct Cache {
+  std::mutex mutex;
+  std::filesystem::path path;
+  std::unordered_map<std::string, CacheEntry> entries;
+  // Whether any entry was parsed or reused since the cache was loaded
+  bool added = false;
+};
+
+Cache& get_cache() {
+  static Cache cache{};
+  return cache;
+}
+
+/// @brief First line of the cache, changed whenever the format of the lines after it changes
+constexpr static std::string_view kCacheHeader = "elf_metadata v3";
+
+/// @brief Parses the comma separated hex lifecycle values written by @ref elf_metadata::save
+bool parse_values(std::string const& field, std::array<uint64_t, elf_metadata::kExportCount>& values) {
+  std::istringstream stream(field);
+  for (size_t i = 0; i < values.size(); i++) {
+    if ((i != 0 && stream.get() != ',') || !(stream >> std::hex >> values[i])) {
+      return false;
+    }
+  }
+  return stream.peek() == std::char_traits<char>::eof();
+}
+
+}  // namespace
+
+namespace elf_metadata {
+
+std::optional<Metadata> parse(modloader::ElfImage const& image) noexcept {
+  auto const& path = image.path();
+  auto reader = image.dynamic();
+  if (!reader) {
+    LOG_ERROR("Failed to read dynamic segment of: {}", path.c_str());
+    return std::nullopt;
+  }
+  Metadata metadata{
+    .needed = reader->needed(),
+    .soname = reader->soname(),
+    .buildId = reader->buildId(),
+    .lifecycle = {},
+  };
+  for (auto [name, value] : { std::pair{ "setup"sv, kSetup }, std::pair{ "load"sv, kLoad },
+                              std::pair{ "late_load"sv, kLateLoad }, std::pair{ "unload"sv, kUnload } }) {
+    auto symbol = reader->find(name);
+    if (!symbol) {
+      continue;
+    }
+    metadata.lifecycle.exports |= value;
+    // An IFUNC's value is its resolver, only dlsym knows what it resolves to
+    if (ELF64_ST_TYPE(symbol->st_info) != STT_GNU_IFUNC) {
+      metadata.lifecycle.values[std::countr_zero(static_cast<unsigned>(value))] = symbol->st_value;
+    }
+  }
+  LOG_DEBUG("Read: {} needed dependencies, soname: {}, exports: 0x{:x} from: {}", metadata.needed.size(),
+            metadata.soname.c_str(), metadata.lifecycle.exports, path.c_str());
+  return metadata;
+}
+
+std::optional<Metadata> get(std::filesystem::path const& path) noexcept {
+  auto& cache = get_cache();
+  // Memfds are recreated on every launch, so their identity never matches a previous one
+  bool cacheable = staging::find_memfd(path) == nullptr;
+
+  // A stat is enough to tell whether the cached metadata is current, the file is only mapped when it is not
+  struct stat64 st {};
+  if (stat64(staging::open_path(path).c_str(), &st) != 0) {
+    LOG_ERROR("Failed to stat dependency: {}: {}", path.c_str(), std::strerror(errno));
+    return std::nullopt;
+  }
+  auto identity = staging::identity_of(st);
+  if (cacheable) {
+    std::unique_lock lock(cache.mutex);
+    auto it = cache.entries.find(path.string());
+    if (it != cache.entries.end() && it->second.identity.same_identity(identity)) {
+      LOG_DEBUG("Hit in ELF metadata cache for: {}", path.c_str());
+      it->second.used = true;
+      return it->second.metadata;
+    }
+  }
+
+  auto image = modloader::ElfImage::open(path);
+  if (image == nullptr) {
+    return std::nullopt;
+  }
+  auto metadata = parse(*image);
+  if (metadata && cacheable) {
+    std::unique_lock lock(cache.mutex);
+    cache.entries.insert_or_assign(path.string(),
+                                   CacheEntry{ .identity = image->identity(), .metadata = *metadata, .used = true });
+    cache.added = true;
+  }
+  return metadata;
+}
+
+void reuse(std::filesystem::path const& source, std::filesystem::path const& copy,
+           staging::FileRecord const& record) noexcept {
+  if (record.stagedInode == 0) {
+    return;
+  }
+  staging::FileRecord copied{ .size = record.stagedSize, .mtime = record.stagedMtime, .inode = record.stagedInode };
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  auto it = cache.entries.find(source.string());
+  if (it == cache.entries.end() || !it->second.used || !it->second.identity.same_identity(record)) {
+    return;
+  }
+  auto existing = cache.entries.find(copy.string());
+  if (existing != cache.entries.end() && existing->second.identity.same_identity(copied)) {
+    return;
+  }
+  LOG_DEBUG("Reusing ELF metadata of: {} for its copy: {}", source.c_str(), copy.c_str());
+  auto metadata = it->second.metadata;
+  // Only persisted if the copy is looked up as well
+  cache.entries.insert_or_assign(copy.string(),
+                                 CacheEntry{ .identity = copied, .metadata = std::move(metadata), .used = false });
+  cache.added = true;
+}
+
+void load(std::filesystem::path const& path) noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  cache.path = path;
+  cache.entries.clear();
+  cache.added = false;
+  std::ifstream file(path);
+  if (!file) {
+    LOG_DEBUG("No ELF metadata cache at: {}", path.c_str());
+    return;
+  }
+  // Each line is: <path>\t<size>\t<mtime>\t<inode>\t<soname>\t<build id>\t<exports>\t<values>[\t<needed>]...
+  // where <values> is the kExportCount lifecycle values, comma separated, and the names are escaped with
+  // staging::escape_field
+  constexpr static size_t kFixedFields = 8;
+  std::string line;
+  if (!std::getline(file, line) || line != kCacheHeader) {
+    LOG_INFO("Discarding ELF metadata cache: {} written by another version", path.c_str());
+    return;
+  }
+  while (std::getline(file, line)) {
+    std::vector<std::string> fields{};
+    std::istringstream stream(line);
+    for (std::string field; std::getline(stream, field, '\t');) {
+      fields.push_back(std::move(field));
+    }
+    CacheEntry entry{};
+    unsigned exports = 0;
+    auto malformed = [&] {
+      LOG_WARN("Discarding malformed ELF metadata cache: {}", path.c_str());
+      cache.entries.clear();
+    };
+    if (fields.size() < kFixedFields ||
+        !(std::istringstream(fields[1]) >> entry.identity.size) ||
+        !(std::istringstream(fields[2]) >> entry.identity.mtime) ||
+        !(std::istringstream(fields[3]) >> entry.identity.inode) ||
+        !(std::istringstream(fields[6]) >> std::hex >> exports) ||
+        !parse_values(fields[7], entry.metadata.lifecycle.values)) {
+      malformed();
+      return;
+    }
+    auto object = staging::unescape_field(fields[0]);
+    auto soname = staging::unescape_field(fields[4]);
+    auto buildId = staging::unescape_field(fields[5]);
+    if (!object || !soname || !buildId) {
+      malformed();
+      return;
+    }
+    entry.metadata.soname = std::move(*soname);
+    entry.metadata.buildId = std::move(*buildId);
+    entry.metadata.lifecycle.exports = static_cast<uint8_t>(exports);
+    for (auto it = fields.begin() + kFixedFields; it != fields.end(); it++) {
+      auto needed = staging::unescape_field(*it);
+      if (!needed) {
+        malformed();
+        return;
+      }
+      entry.metadata.needed.push_back(std::move(*needed));
+    }
+    cache.entries.insert_or_assign(std::move(*object), std::move(entry));
+  }
+  LOG_DEBUG("Read {} entries from ELF metadata cache: {}", cache.entries.size(), path.c_str());
+}
+
+bool save() noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  if (cache.path.empty()) {
+    return false;
+  }
+  auto all_used = std::all_of(cache.entries.begin(), cache.entries.end(),
+                              [](auto const& pair) { return pair.second.used; });
+  if (!cache.added && all_used) {
+    return true;
+  }
+  auto tmp = cache.path;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file) {
+      LOG_ERROR("Failed to open ELF metadata cache: {} for writing", tmp.c_str());
+      return false;
+    }
+    file << kCacheHeader << '\n';
+    for (auto const& [path, entry] : cache.entries) {
+      if (!entry.used) {
+        continue;
+      }
+      auto const& metadata = entry.metadata;
+      file << staging::escape_field(path) << '\t' << entry.identity.size << '\t' << entry.identity.mtime << '\t'
+           << entry.identity.inode << '\t' << staging::escape_field(metadata.soname) << '\t'
+           << staging::escape_field(metadata.buildId) << '\t' << std::hex
+           << static_cast<unsigned>(metadata.lifecycle.exports) << '\t';
+      for (size_t i = 0; i < metadata.lifecycle.values.size(); i++) {
+        file << (i == 0 ? "" : ",") << metadata.lifecycle.values[i];
+      }
+      file << std::dec;
+      for (auto const& needed : metadata.needed) {
+        file << '\t' << staging::escape_field(needed);
+      }
+      file << '\n';
+    }
+    if (!file.flush()) {
+      LOG_ERROR("Failed to write ELF metadata cache: {}", tmp.c_str());
+      return false;
+    }
+  }
+  std::error_code error_code;
+  std::filesystem::rename(tmp, cache.path, error_code);
+  if (error_code) {
+    LOG_ERROR("Failed to replace ELF metadata cache: {}: {}", cache.path.c_str(), error_code.message().c_str());
+    return false;
+  }
+  // What is on disk now matches what is in memory
+  cache.added = false;
+  std::erase_if(cache.entries, [](auto const& pair) { return !pair.second.used; });
+  return true;
+}
+
+}  // namespace elf_metadata
@@ -1,56 +1,748 @@
-#include "elf-utils.hpp"
-#include "log.h"
-
-#include <link.h>
-
-namespace elf_utils {
-  
-  void* getSymbol(std::span<uint8_t> f, std::string_view symbol_name) { 
-    auto elf = readAtOffset<Elf64_Ehdr>(f, 0);
-    LOG_DEBUG("Header read: ehsize: {}, type: {}, version: {}, shentsize: {}", elf.e_ehsize, elf.e_type, elf.e_version,
-              elf.e_shentsize);
-    auto sections = readManyAtOffset<Elf64_Shdr>(f, elf.e_shoff, elf.e_shnum, elf.e_shentsize);
-    Elf64_Shdr symtab, strtab;
-    symtab.sh_addr = 0;
-    strtab.sh_addr = 0;
-    for (auto const& sectionHeader : sections) {
-      if (sectionHeader.sh_type == SHT_SYMTAB) {
-        symtab = sectionHeader;
-      }
-      if (sectionHeader.sh_type == SHT_STRTAB) {
-        strtab = sectionHeader;
-      }
-      if(symtab.sh_addr && strtab.sh_addr)
-        break;
-    }
-    auto symbols = readManyAtOffset<Elf64_Sym>(f, symtab.sh_offset, symtab.sh_size / symtab.sh_entsize, symtab.sh_entsize);
-    for (auto const& symbol : symbols) {
-      std::string_view name = &readAtOffset<char const>(f, strtab.sh_offset + symbol.st_name);
-      if(symbol_name == name)
-        return reinterpret_cast<void*>(symbol.st_value);
-    }
-    return nullptr;
-  }
-
-  uintptr_t baseAddr(char const* soname) {
-    if (soname == NULL) return (uintptr_t)NULL;
-    struct bdata {
-      uintptr_t base;
-      char const* soname;
-    };
-    bdata dat;
-    dat.soname = soname;
-    int status = dl_iterate_phdr([] (dl_phdr_info* info, size_t, void* data) {
-        bdata* dat = reinterpret_cast<bdata*>(data);
-        if (std::string(info->dlpi_name).find(dat->soname) != std::string::npos) {
-          dat->base = (uintptr_t)info->dlpi_addr;
-          return 1;
-        }
-        return 0;
-    }, &dat);
-    if(status)
-      return dat.base;
-    return (uintptr_t)NULL;
-  }
-
-}
\ No newline at end of file
+#include "elf-utils.hpp"
+#include "log.h"
+
+#include <link.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+namespace elf_utils {
+  
+  void* getSymbol(std::span<uint8_t> f, std::string_view symbol_name) {
+    auto lookup = SymbolLookup::create(f);
+    if (!lookup) {
+      return nullptr;
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return reinterpret_cast<void*>(lookup->find(symbol_name).value_or(0));
+  }
+
+  uintptr_t baseAddr(char const* soname) {
+    if (soname == NULL) return (uintptr_t)NULL;
+    struct bdata {
+      uintptr_t base;
+      char const* soname;
+    };
+    bdata dat;
+    dat.soname = soname;
+    int status = dl_iterate_phdr([] (dl_phdr_info* info, size_t, void* data) {
+        bdata* dat = reinterpret_cast<bdata*>(data);
+        if (std::string(info->dlpi_name).find(dat->soname) != std::string::npos) {
+          dat->base = (uintptr_t)info->dlpi_addr;
+          return 1;
+        }
+        return 0;
+    }, &dat);
+    if(status)
+      return dat.base;
+    return (uintptr_t)NULL;
+  }
+
+
+  namespace {
+    // Upper bounds on what we are willing to read from a single file, anything beyond these is treated as malformed
+    constexpr uint64_t kMaxProgramHeaders = 256;
+    constexpr uint64_t kMaxDynamicEntries = 4096;
+    constexpr uint64_t kMaxNoteSize = 64 * 1024;
+    constexpr size_t kStringChunk = 128;
+    constexpr uint64_t kMaxSymbols = 1 << 20;
+    constexpr uint64_t kMaxStringTable = 32 * 1024 * 1024;
+    constexpr uint64_t kMaxVersions = 4096;
+    // The bit of a DT_VERSYM entry that hides a definition from unversioned lookups, the rest is the version index
+    constexpr Elf64_Half kVersymHidden = 0x8000;
+
+    uint32_t gnu_hash(std::string_view name) {
+      uint32_t hash = 5381;
+      for (auto c : name) {
+        hash = hash * 33 + static_cast<uint8_t>(c);
+      }
+      return hash;
+    }
+
+    uint32_t sysv_hash(std::string_view name) {
+      uint32_t hash = 0;
+      for (auto c : name) {
+        hash = (hash << 4) + static_cast<uint8_t>(c);
+        hash ^= (hash >> 24) & 0xF0;
+      }
+      return hash & 0x0FFFFFFF;
+    }
+
+    /// @brief Finds the index of the symbol called name in a DT_GNU_HASH table held in memory
+    /// @param matches Whether the symbol at an index is called name, must bounds check the index
+    template <typename Matches>
+    std::optional<uint32_t> gnu_find(GnuHashTable const& table, std::string_view name, Matches&& matches) noexcept {
+      if (table.buckets.empty() || table.bloom.empty()) {
+        return std::nullopt;
+      }
+      auto hash = gnu_hash(name);
+      auto word = table.bloom[(hash / 64) % table.bloom.size()];
+      uint64_t mask = (uint64_t{ 1 } << (hash % 64)) | (uint64_t{ 1 } << ((hash >> table.bloomShift) % 64));
+      if ((word & mask) != mask) {
+        return std::nullopt;
+      }
+      auto index = table.buckets[hash % table.buckets.size()];
+      if (index < table.symoffset) {
+        return std::nullopt;
+      }
+      for (auto i = index; i - table.symoffset < table.chains.size(); i++) {
+        auto chain_hash = table.chains[i - table.symoffset];
+        if ((chain_hash | 1) == (hash | 1) && matches(i)) {
+          return i;
+        }
+        if ((chain_hash & 1) != 0) {
+          break;
+        }
+      }
+      return std::nullopt;
+    }
+
+    /// @brief Finds the index of the symbol called name in a DT_HASH table held in memory
+    /// @param matches Whether the symbol at an index is called name, must bounds check the index
+    template <typename Matches>
+    std::optional<uint32_t> sysv_find(SysvHashTable const& table, std::string_view name, Matches&& matches) noexcept {
+      if (table.buckets.empty()) {
+        return std::nullopt;
+      }
+      auto index = table.buckets[sysv_hash(name) % table.buckets.size()];
+      // Bounded by the number of symbols, so a cyclic chain cannot loop forever
+      for (size_t steps = 0; index != STN_UNDEF && index < table.chains.size() && steps < table.chains.size();
+           steps++) {
+        if (matches(index)) {
+          return index;
+        }
+        index = table.chains[index];
+      }
+      return std::nullopt;
+    }
+
+    /// @brief The NUL terminated string at offset in strings, empty if it is out of bounds
+    std::string_view string_at(std::span<char const> strings, uint64_t offset) noexcept {
+      if (offset >= strings.size()) {
+        return {};
+      }
+      auto const* begin = strings.data() + offset;
+      return { begin, strnlen(begin, strings.size() - offset) };
+    }
+  }  // namespace
+
+  bool DynamicReader::readInto(uint64_t offset, void* data, size_t length) const noexcept {
+    if (offset > size || size - offset < length) {
+      return false;
+    }
+    if (!image.empty()) {
+      std::memcpy(data, image.data() + offset, length);
+      return true;
+    }
+    auto* out = static_cast<uint8_t*>(data);
+    while (length > 0) {
+      auto count = pread64(fd, out, length, static_cast<off64_t>(offset));
+      if (count < 0 && errno == EINTR) continue;
+      if (count <= 0) {
+        return false;
+      }
+      out += count;
+      offset += count;
+      length -= count;
+    }
+    return true;
+  }
+
+  template <typename T>
+  std::optional<T> DynamicReader::read(uint64_t offset) const noexcept {
+    T value;
+    if (!readInto(offset, &value, sizeof(T))) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  std::optional<uint64_t> DynamicReader::toOffset(uint64_t vaddr, uint64_t length) const noexcept {
+    for (auto const& load : loads) {
+      if (vaddr < load.p_vaddr || vaddr - load.p_vaddr >= load.p_filesz) {
+        continue;
+      }
+      auto offset = load.p_offset + (vaddr - load.p_vaddr);
+      // Must lie entirely within the file backed part of the segment
+      if (load.p_filesz - (vaddr - load.p_vaddr) < length) {
+        return std::nullopt;
+      }
+      return offset;
+    }
+    return std::nullopt;
+  }
+
+  std::optional<DynamicReader> DynamicReader::open(int fd, uint64_t size) noexcept {
+    return parse(DynamicReader(fd, size));
+  }
+
+  std::optional<DynamicReader> DynamicReader::open(std::span<uint8_t const> image) noexcept {
+    return parse(DynamicReader(image));
+  }
+
+  std::optional<DynamicReader> DynamicReader::parse(DynamicReader reader) noexcept {
+    auto elf = reader.read<Elf64_Ehdr>(0);
+    if (!elf || std::memcmp(elf->e_ident, ELFMAG, SELFMAG) != 0 || elf->e_ident[EI_CLASS] != ELFCLASS64) {
+      LOG_ERROR("Not a 64 bit ELF");
+      return std::nullopt;
+    }
+    LOG_DEBUG("Header read: ehsize: {}, type: {}, version: {}, phentsize: {}", elf->e_ehsize, elf->e_type,
+              elf->e_version, elf->e_phentsize);
+    if (elf->e_phentsize < sizeof(Elf64_Phdr) || elf->e_phnum > kMaxProgramHeaders) {
+      LOG_ERROR("Bad program headers: phentsize: {}, phnum: {}", elf->e_phentsize, elf->e_phnum);
+      return std::nullopt;
+    }
+    std::optional<Elf64_Phdr> dynamic_header{};
+    for (uint64_t i = 0; i < elf->e_phnum; i++) {
+      auto header = reader.read<Elf64_Phdr>(elf->e_phoff + i * elf->e_phentsize);
+      if (!header) {
+        LOG_ERROR("Program header: {} is out of bounds", i);
+        return std::nullopt;
+      }
+      if (header->p_type == PT_LOAD) {
+        reader.loads.push_back(*header);
+      } else if (header->p_type == PT_NOTE) {
+        reader.notes.push_back(*header);
+      } else if (header->p_type == PT_DYNAMIC) {
+        dynamic_header = header;
+      }
+    }
+    if (!dynamic_header) {
+      // Statically linked, there is nothing more to read
+      return reader;
+    }
+    auto count = std::min<uint64_t>(dynamic_header->p_filesz / sizeof(Elf64_Dyn), kMaxDynamicEntries);
+    reader.dynamic.resize(count);
+    if (!reader.readInto(dynamic_header->p_offset, reader.dynamic.data(), count * sizeof(Elf64_Dyn))) {
+      LOG_ERROR("Dynamic segment is out of bounds");
+      return std::nullopt;
+    }
+    std::optional<uint64_t> strtab_addr{};
+    for (size_t i = 0; i < reader.dynamic.size(); i++) {
+      auto const& dyn = reader.dynamic[i];
+      if (dyn.d_tag == DT_NULL) {
+        LOG_DEBUG("End of dynamic segment. Counted a total of: {} dynamic entries", i + 1);
+        reader.dynamic.resize(i);
+        break;
+      }
+      // NOLINTBEGIN(cppcoreguidelines-pro-type-union-access)
+      switch (dyn.d_tag) {
+        case DT_STRTAB:
+          strtab_addr = dyn.d_un.d_ptr;
+          break;
+        case DT_STRSZ:
+          reader.strsz = dyn.d_un.d_val;
+          break;
+        case DT_SYMTAB:
+          reader.symtab = reader.toOffset(dyn.d_un.d_ptr, sizeof(Elf64_Sym)).value_or(0);
+          break;
+        case DT_GNU_HASH:
+          reader.gnuHash = reader.toOffset(dyn.d_un.d_ptr, sizeof(uint32_t) * 4).value_or(0);
+          break;
+        case DT_HASH:
+          reader.sysvHash = reader.toOffset(dyn.d_un.d_ptr, sizeof(uint32_t) * 2).value_or(0);
+          break;
+        case DT_VERSYM:
+          reader.versym = reader.toOffset(dyn.d_un.d_ptr, sizeof(Elf64_Half)).value_or(0);
+          break;
+        case DT_VERNEED:
+          reader.verneed = reader.toOffset(dyn.d_un.d_ptr, sizeof(Elf64_Verneed)).value_or(0);
+          break;
+        case DT_VERNEEDNUM:
+          reader.verneedNum = dyn.d_un.d_val;
+          break;
+        default:
+          break;
+      }
+      // NOLINTEND(cppcoreguidelines-pro-type-union-access)
+    }
+    // DT_STRTAB is a virtual address, which only matches the file offset when the first segment starts at 0
+    if (strtab_addr) {
+      auto offset = reader.toOffset(*strtab_addr, reader.strsz);
+      if (!offset) {
+        LOG_ERROR("DT_STRTAB: 0x{:x} with size: {} is outside of every PT_LOAD", *strtab_addr, reader.strsz);
+        return std::nullopt;
+      }
+      reader.strtab = *offset;
+    }
+    return reader;
+  }
+
+  std::optional<std::string> DynamicReader::readString(uint64_t offset) const noexcept {
+    if (strtab == 0 || offset >= strsz) {
+      return std::nullopt;
+    }
+    std::string result{};
+    std::array<char, kStringChunk> chunk{};
+    while (offset < strsz) {
+      auto length = std::min<uint64_t>(chunk.size(), strsz - offset);
+      if (!readInto(strtab + offset, chunk.data(), length)) {
+        return std::nullopt;
+      }
+      auto const* end = static_cast<char const*>(std::memchr(chunk.data(), '\0', length));
+      if (end != nullptr) {
+        result.append(chunk.data(), static_cast<size_t>(end - chunk.data()));
+        return result;
+      }
+      result.append(chunk.data(), length);
+      offset += length;
+    }
+    // Ran off the end of the string table without a terminator
+    return std::nullopt;
+  }
+
+  std::vector<std::string> DynamicReader::needed() const noexcept {
+    std::vector<std::string> names{};
+    for (auto const& dyn : dynamic) {
+      if (dyn.d_tag != DT_NEEDED) {
+        continue;
+      }
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+      auto name = readString(dyn.d_un.d_val);
+      if (!name || name->empty()) {
+        LOG_WARN("DT_NEEDED str is bad! Bad ELF, but continuing anyways...");
+        continue;
+      }
+      LOG_DEBUG("DT_NEEDED name: {}", name->c_str());
+      names.push_back(std::move(*name));
+    }
+    return names;
+  }
+
+  std::string DynamicReader::soname() const noexcept {
+    for (auto const& dyn : dynamic) {
+      if (dyn.d_tag == DT_SONAME) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+        return readString(dyn.d_un.d_val).value_or("");
+      }
+    }
+    return {};
+  }
+
+  std::string DynamicReader::buildId() const noexcept {
+    constexpr auto align = [](uint64_t value) { return (value + 3) & ~uint64_t{ 3 }; };
+    for (auto const& note_header : notes) {
+      if (note_header.p_filesz > kMaxNoteSize) {
+        continue;
+      }
+      std::vector<uint8_t> bytes(note_header.p_filesz);
+      if (!readInto(note_header.p_offset, bytes.data(), bytes.size())) {
+        continue;
+      }
+      for (uint64_t offset = 0; bytes.size() - offset >= sizeof(Elf64_Nhdr);) {
+        Elf64_Nhdr note;
+        std::memcpy(&note, bytes.data() + offset, sizeof(note));
+        auto name_offset = offset + sizeof(Elf64_Nhdr);
+        auto desc_offset = name_offset + align(note.n_namesz);
+        auto next = desc_offset + align(note.n_descsz);
+        if (next > bytes.size()) {
+          break;
+        }
+        if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == sizeof(ELF_NOTE_GNU) &&
+            std::memcmp(bytes.data() + name_offset, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0) {
+          constexpr static char kHex[] = "0123456789abcdef";
+          std::string result{};
+          for (uint64_t i = 0; i < note.n_descsz; i++) {
+            auto byte = bytes[desc_offset + i];
+            result.push_back(kHex[byte >> 4]);
+            result.push_back(kHex[byte & 0xF]);
+          }
+          return result;
+        }
+        offset = next;
+      }
+    }
+    return {};
+  }
+
+  std::optional<std::pair<Elf64_Sym, std::string>> DynamicReader::readSymbol(uint32_t index) const noexcept {
+    auto symbol = read<Elf64_Sym>(symtab + static_cast<uint64_t>(index) * sizeof(Elf64_Sym));
+    if (!symbol) {
+      return std::nullopt;
+    }
+    auto name = readString(symbol->st_name);
+    if (!name) {
+      return std::nullopt;
+    }
+    return std::make_pair(*symbol, std::move(*name));
+  }
+
+  std::optional<Elf64_Sym> DynamicReader::gnuFind(std::string_view symbol) const noexcept {
+    struct Header {
+      uint32_t nbuckets;
+      uint32_t symoffset;
+      uint32_t bloomSize;
+      uint32_t bloomShift;
+    };
+    auto header = read<Header>(gnuHash);
+    if (!header || header->nbuckets == 0 || header->bloomSize == 0 || header->bloomShift >= 32) {
+      return std::nullopt;
+    }
+    auto hash = gnu_hash(symbol);
+    auto bloom_offset = gnuHash + sizeof(Header);
+    auto word = read<uint64_t>(bloom_offset + ((hash / 64) % header->bloomSize) * sizeof(uint64_t));
+    uint64_t mask = (uint64_t{ 1 } << (hash % 64)) | (uint64_t{ 1 } << ((hash >> header->bloomShift) % 64));
+    if (!word || (*word & mask) != mask) {
+      return std::nullopt;
+    }
+    auto buckets_offset = bloom_offset + static_cast<uint64_t>(header->bloomSize) * sizeof(uint64_t);
+    auto chains_offset = buckets_offset + static_cast<uint64_t>(header->nbuckets) * sizeof(uint32_t);
+    auto index = read<uint32_t>(buckets_offset + (hash % header->nbuckets) * sizeof(uint32_t));
+    if (!index || *index < header->symoffset) {
+      return std::nullopt;
+    }
+    for (auto i = *index;; i++) {
+      auto chain_hash = read<uint32_t>(chains_offset + static_cast<uint64_t>(i - header->symoffset) * sizeof(uint32_t));
+      if (!chain_hash) {
+        return std::nullopt;
+      }
+      if ((*chain_hash | 1) == (hash | 1)) {
+        auto entry = readSymbol(i);
+        if (entry && entry->second == symbol) {
+          return entry->first;
+        }
+      }
+      if ((*chain_hash & 1) != 0) {
+        return std::nullopt;
+      }
+    }
+  }
+
+  std::optional<Elf64_Sym> DynamicReader::sysvFind(std::string_view symbol) const noexcept {
+    auto nbucket = read<uint32_t>(sysvHash);
+    auto nchain = read<uint32_t>(sysvHash + sizeof(uint32_t));
+    if (!nbucket || !nchain || *nbucket == 0) {
+      return std::nullopt;
+    }
+    auto buckets_offset = sysvHash + 2 * sizeof(uint32_t);
+    auto chains_offset = buckets_offset + static_cast<uint64_t>(*nbucket) * sizeof(uint32_t);
+    auto index = read<uint32_t>(buckets_offset + (sysv_hash(symbol) % *nbucket) * sizeof(uint32_t));
+    // Bounded by nchain, so a cyclic chain cannot loop forever
+    for (uint32_t steps = 0; index && *index != STN_UNDEF && steps < *nchain; steps++) {
+      auto entry = readSymbol(*index);
+      if (entry && entry->second == symbol) {
+        return entry->first;
+      }
+      index = read<uint32_t>(chains_offset + static_cast<uint64_t>(*index) * sizeof(uint32_t));
+    }
+    return std::nullopt;
+  }
+
+  bool DynamicReader::defines(std::string_view symbol) const noexcept {
+    return find(symbol).has_value();
+  }
+
+  std::optional<Elf64_Sym> DynamicReader::find(std::string_view symbol) const noexcept {
+    if (symtab == 0 || strtab == 0) {
+      return std::nullopt;
+    }
+    auto entry = gnuHash != 0 ? gnuFind(symbol) : sysvHash != 0 ? sysvFind(symbol) : std::nullopt;
+    if (!entry || entry->st_shndx == SHN_UNDEF) {
+      return std::nullopt;
+    }
+    return entry;
+  }
+
+  std::optional<uint32_t> DynamicReader::symbolCount() const noexcept {
+    if (gnuHash == 0) {
+      // DT_HASH has one chain entry per symbol
+      auto nchain = read<uint32_t>(sysvHash + sizeof(uint32_t));
+      if (sysvHash == 0 || !nchain || *nchain > kMaxSymbols) {
+        return std::nullopt;
+      }
+      return *nchain;
+    }
+    // DT_GNU_HASH only covers the symbols from symoffset onwards. The last one is at the end of the chain of the
+    // highest bucket.
+    auto nbuckets = read<uint32_t>(gnuHash);
+    auto symoffset = read<uint32_t>(gnuHash + sizeof(uint32_t));
+    auto bloom_size = read<uint32_t>(gnuHash + 2 * sizeof(uint32_t));
+    if (!nbuckets || !symoffset || !bloom_size || *nbuckets > kMaxSymbols || *symoffset > kMaxSymbols) {
+      return std::nullopt;
+    }
+    auto buckets_offset = gnuHash + 4 * sizeof(uint32_t) + static_cast<uint64_t>(*bloom_size) * sizeof(uint64_t);
+    std::vector<uint32_t> buckets(*nbuckets);
+    if (!readInto(buckets_offset, buckets.data(), buckets.size() * sizeof(uint32_t))) {
+      return std::nullopt;
+    }
+    auto last = std::max_element(buckets.begin(), buckets.end());
+    if (last == buckets.end() || *last < *symoffset) {
+      return *symoffset;
+    }
+    auto chains_offset = buckets_offset + buckets.size() * sizeof(uint32_t);
+    for (auto i = *last; i < kMaxSymbols; i++) {
+      auto chain_hash = read<uint32_t>(chains_offset + static_cast<uint64_t>(i - *symoffset) * sizeof(uint32_t));
+      if (!chain_hash) {
+        return std::nullopt;
+      }
+      if ((*chain_hash & 1) != 0) {
+        return i + 1;
+      }
+    }
+    return std::nullopt;
+  }
+
+  void DynamicReader::readVersions(SymbolTable& table) const noexcept {
+    if (versym == 0 || verneed == 0) {
+      return;
+    }
+    std::vector<Elf64_Half> versions(table.symbols.size());
+    if (!readInto(versym, versions.data(), versions.size() * sizeof(Elf64_Half))) {
+      LOG_WARN("DT_VERSYM is out of bounds, reading symbols without versions");
+      return;
+    }
+    std::vector<std::pair<Elf64_Half, uint32_t>> names{};
+    auto need_offset = verneed;
+    for (uint64_t i = 0; i < std::min(verneedNum, kMaxVersions); i++) {
+      auto need = read<Elf64_Verneed>(need_offset);
+      if (!need) {
+        LOG_WARN("DT_VERNEED entry: {} is out of bounds, reading symbols without versions", i);
+        return;
+      }
+      auto aux_offset = need_offset + need->vn_aux;
+      for (uint64_t j = 0; j < std::min<uint64_t>(need->vn_cnt, kMaxVersions); j++) {
+        auto aux = read<Elf64_Vernaux>(aux_offset);
+        if (!aux) {
+          LOG_WARN("DT_VERNEED entry: {} is out of bounds, reading symbols without versions", i);
+          return;
+        }
+        names.emplace_back(aux->vna_other, aux->vna_name);
+        if (aux->vna_next == 0) {
+          break;
+        }
+        aux_offset += aux->vna_next;
+      }
+      if (need->vn_next == 0) {
+        break;
+      }
+      need_offset += need->vn_next;
+    }
+    table.versions = std::move(versions);
+    table.versionNames = std::move(names);
+  }
+
+  std::optional<SymbolTable> DynamicReader::symbolTable() const noexcept {
+    if (symtab == 0 || strtab == 0 || strsz > kMaxStringTable) {
+      return std::nullopt;
+    }
+    auto count = symbolCount();
+    if (!count) {
+      LOG_WARN("Could not tell the size of the dynamic symbol table");
+      return std::nullopt;
+    }
+    SymbolTable table{};
+    table.symbols.resize(*count);
+    table.strings.resize(strsz);
+    if (!readInto(symtab, table.symbols.data(), table.symbols.size() * sizeof(Elf64_Sym)) ||
+        !readInto(strtab, table.strings.data(), table.strings.size())) {
+      LOG_WARN("Dynamic symbol table with: {} symbols is out of bounds", *count);
+      return std::nullopt;
+    }
+    readVersions(table);
+    if (gnuHash != 0) {
+      auto nbuckets = read<uint32_t>(gnuHash);
+      auto symoffset = read<uint32_t>(gnuHash + sizeof(uint32_t));
+      auto bloom_size = read<uint32_t>(gnuHash + 2 * sizeof(uint32_t));
+      auto bloom_shift = read<uint32_t>(gnuHash + 3 * sizeof(uint32_t));
+      if (!nbuckets || !symoffset || !bloom_size || !bloom_shift || *bloom_size > kMaxSymbols ||
+          *bloom_shift >= 32 || *symoffset > *count) {
+        return std::nullopt;
+      }
+      if (*nbuckets == 0 || *bloom_size == 0) {
+        // Nothing is exported
+        return table;
+      }
+      table.bloom.resize(*bloom_size);
+      table.buckets.resize(*nbuckets);
+      table.chains.resize(*count - *symoffset);
+      auto bloom_offset = gnuHash + 4 * sizeof(uint32_t);
+      auto buckets_offset = bloom_offset + table.bloom.size() * sizeof(uint64_t);
+      auto chains_offset = buckets_offset + table.buckets.size() * sizeof(uint32_t);
+      if (!readInto(bloom_offset, table.bloom.data(), table.bloom.size() * sizeof(uint64_t)) ||
+          !readInto(buckets_offset, table.buckets.data(), table.buckets.size() * sizeof(uint32_t)) ||
+          !readInto(chains_offset, table.chains.data(), table.chains.size() * sizeof(uint32_t))) {
+        return std::nullopt;
+      }
+      table.gnu = GnuHashTable{ .symoffset = *symoffset,
+                                .bloomShift = *bloom_shift,
+                                .bloom = table.bloom,
+                                .buckets = table.buckets,
+                                .chains = table.chains };
+    } else {
+      auto nbucket = read<uint32_t>(sysvHash);
+      if (!nbucket || *nbucket > kMaxSymbols) {
+        return std::nullopt;
+      }
+      table.buckets.resize(*nbucket);
+      table.chains.resize(*count);
+      auto buckets_offset = sysvHash + 2 * sizeof(uint32_t);
+      auto chains_offset = buckets_offset + table.buckets.size() * sizeof(uint32_t);
+      if (!readInto(buckets_offset, table.buckets.data(), table.buckets.size() * sizeof(uint32_t)) ||
+          !readInto(chains_offset, table.chains.data(), table.chains.size() * sizeof(uint32_t))) {
+        return std::nullopt;
+      }
+      table.sysv = SysvHashTable{ .buckets = table.buckets, .chains = table.chains };
+    }
+    return table;
+  }
+
+  std::string_view SymbolTable::nameOf(Elf64_Sym const& symbol) const noexcept {
+    return string_at(strings, symbol.st_name);
+  }
+
+  bool SymbolTable::matches(uint32_t index, std::string_view symbol) const noexcept {
+    return index < symbols.size() && nameOf(symbols[index]) == symbol;
+  }
+
+  bool SymbolTable::defines(std::string_view symbol) const noexcept {
+    auto matches = [&](uint32_t index) { return this->matches(index, symbol); };
+    auto found = gnu.buckets.empty() ? sysv_find(sysv, symbol, matches) : gnu_find(gnu, symbol, matches);
+    return found && symbols[*found].st_shndx != SHN_UNDEF;
+  }
+
+  std::string_view SymbolTable::versionOf(size_t index) const noexcept {
+    if (index >= versions.size()) {
+      return {};
+    }
+    // The top bit marks hidden versions, which only matters for definitions
+    auto version = static_cast<Elf64_Half>(versions[index] & ~kVersymHidden);
+    if (version <= VER_NDX_GLOBAL) {
+      return {};
+    }
+    for (auto const& [other, name] : versionNames) {
+      if (other == version) {
+        return string_at(strings, name);
+      }
+    }
+    return {};
+  }
+
+  std::vector<RequiredSymbol> SymbolTable::required() const noexcept {
+    std::vector<RequiredSymbol> names{};
+    // Symbol 0 is always the null symbol
+    for (size_t i = 1; i < symbols.size(); i++) {
+      auto const& symbol = symbols[i];
+      if (symbol.st_shndx != SHN_UNDEF || ELF64_ST_BIND(symbol.st_info) != STB_GLOBAL) {
+        continue;
+      }
+      auto name = nameOf(symbol);
+      if (!name.empty()) {
+        names.push_back({ .name = name, .version = versionOf(i) });
+      }
+    }
+    return names;
+  }
+
+  namespace {
+    /// @brief A view of count entries of T at offset in file, empty if they are out of bounds or misaligned
+    template <typename T>
+    std::span<T const> view_of(std::span<uint8_t const> file, uint64_t offset, uint64_t count) noexcept {
+      if (offset > file.size() || count > (file.size() - offset) / sizeof(T) ||
+          reinterpret_cast<uintptr_t>(file.data() + offset) % alignof(T) != 0) {
+        return {};
+      }
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      return { reinterpret_cast<T const*>(file.data() + offset), static_cast<size_t>(count) };
+    }
+  }  // namespace
+
+  std::string_view SymbolLookup::Table::nameOf(uint32_t index) const noexcept {
+    return index < symbols.size() ? string_at(strings, symbols[index].st_name) : std::string_view{};
+  }
+
+  std::optional<SymbolLookup> SymbolLookup::create(std::span<uint8_t const> file) noexcept {
+    auto elf = view_of<Elf64_Ehdr>(file, 0, 1);
+    if (elf.empty() || std::memcmp(elf[0].e_ident, ELFMAG, SELFMAG) != 0 || elf[0].e_ident[EI_CLASS] != ELFCLASS64 ||
+        elf[0].e_shentsize != sizeof(Elf64_Shdr)) {
+      LOG_ERROR("Not a 64 bit ELF with section headers");
+      return std::nullopt;
+    }
+    auto sections = view_of<Elf64_Shdr>(file, elf[0].e_shoff, elf[0].e_shnum);
+    if (sections.size() != elf[0].e_shnum) {
+      LOG_ERROR("Section headers are out of bounds");
+      return std::nullopt;
+    }
+    // Pairs a symbol table section with the string table its sh_link names
+    auto table_of = [&](Elf64_Shdr const& section) -> Table {
+      if (section.sh_entsize != sizeof(Elf64_Sym) || section.sh_link >= sections.size()) {
+        return {};
+      }
+      auto const& strings = sections[section.sh_link];
+      auto bytes = view_of<char>(file, strings.sh_offset, strings.sh_size);
+      if (strings.sh_type != SHT_STRTAB || bytes.size() != strings.sh_size) {
+        return {};
+      }
+      return { .symbols = view_of<Elf64_Sym>(file, section.sh_offset, section.sh_size / sizeof(Elf64_Sym)),
+               .strings = bytes };
+    };
+
+    SymbolLookup lookup{};
+    for (auto const& section : sections) {
+      if (section.sh_type == SHT_SYMTAB && lookup.symtab.symbols.empty()) {
+        lookup.symtab = table_of(section);
+      } else if (section.sh_type == SHT_DYNSYM && lookup.dynsym.symbols.empty()) {
+        lookup.dynsym = table_of(section);
+      }
+    }
+    for (auto const& section : sections) {
+      // Hash sections name the symbol table they index through sh_link, which is .dynsym
+      if (section.sh_link >= sections.size() || sections[section.sh_link].sh_type != SHT_DYNSYM) {
+        continue;
+      }
+      auto words = view_of<uint32_t>(file, section.sh_offset, section.sh_size / sizeof(uint32_t));
+      if (section.sh_type == SHT_GNU_HASH && words.size() >= 4) {
+        auto nbuckets = words[0];
+        auto bloom_size = words[2];
+        auto bloom = view_of<uint64_t>(file, section.sh_offset + 4 * sizeof(uint32_t), bloom_size);
+        auto rest = words.subspan(std::min<size_t>(words.size(), 4 + 2 * static_cast<size_t>(bloom_size)));
+        if (bloom.size() != bloom_size || words[3] >= 32 || rest.size() < nbuckets) {
+          continue;
+        }
+        lookup.gnu = GnuHashTable{ .symoffset = words[1],
+                                   .bloomShift = words[3],
+                                   .bloom = bloom,
+                                   .buckets = rest.first(nbuckets),
+                                   .chains = rest.subspan(nbuckets) };
+      } else if (section.sh_type == SHT_HASH && words.size() >= 2) {
+        auto nbucket = words[0];
+        auto nchain = words[1];
+        if (words.size() - 2 < static_cast<uint64_t>(nbucket) + nchain) {
+          continue;
+        }
+        lookup.sysv =
+            SysvHashTable{ .buckets = words.subspan(2, nbucket), .chains = words.subspan(2 + nbucket, nchain) };
+      }
+    }
+
+    lookup.symtabIndex.reserve(lookup.symtab.symbols.size());
+    for (uint32_t i = 1; i < lookup.symtab.symbols.size(); i++) {
+      auto name = lookup.symtab.nameOf(i);
+      if (!name.empty()) {
+        lookup.symtabIndex.emplace_back(gnu_hash(name), i);
+      }
+    }
+    // Sorting pairs keeps entries with the same hash in table order, so the first match is the first in the table
+    std::sort(lookup.symtabIndex.begin(), lookup.symtabIndex.end());
+    LOG_DEBUG("Indexed {} .symtab and {} .dynsym symbols", lookup.symtabIndex.size(), lookup.dynsym.symbols.size());
+    return lookup;
+  }
+
+  std::optional<uint64_t> SymbolLookup::find(std::string_view name) const noexcept {
+    auto matches = [&](uint32_t index) { return dynsym.nameOf(index) == name; };
+    auto found = gnu.buckets.empty() ? sysv_find(sysv, name, matches) : gnu_find(gnu, name, matches);
+    if (found && dynsym.symbols[*found].st_shndx != SHN_UNDEF) {
+      return dynsym.symbols[*found].st_value;
+    }
+    auto hash = gnu_hash(name);
+    auto it = std::lower_bound(symtabIndex.begin(), symtabIndex.end(), std::make_pair(hash, uint32_t{ 0 }));
+    for (; it != symtabIndex.end() && it->first == hash; ++it) {
+      auto const& symbol = symtab.symbols[it->second];
+      if (symbol.st_shndx != SHN_UNDEF && symtab.nameOf(it->second) == name) {
+        return symbol.st_value;
+      }
+    }
+    return std::nullopt;
+  }
+}
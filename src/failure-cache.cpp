@@ -0,0 +1,217 @@
+#include "failure-cache.hpp"
+#include "log.h"
+#include "staging.hpp"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+struct CacheEntry {
+  uint64_t key;
+  std::string failure;
+  // Whether the object was looked up or recorded during this launch, only those are persisted
+  bool used;
+  // Whether the failure was recorded in an earlier launch. Failures are only reported instead of opening from the
+  // next launch on, the same launch opens an object once at most anyway.
+  bool persisted;
+};
+
+struct Cache {
+  std::mutex mutex;
+  std::filesystem::path path;
+  uint64_t environment{};
+  std::unordered_map<std::string, CacheEntry> entries;
+  // Whether any failure was recorded or forgotten since the cache was loaded
+  bool changed = false;
+};
+
+Cache& get_cache() {
+  static Cache cache{};
+  return cache;
+}
+
+/// @brief First line of the cache, followed by a tab and the environment. Changed whenever the format changes.
+constexpr static std::string_view kCacheHeader = "failed_objects v1";
+
+template <typename T>
+std::span<uint8_t const> bytes_of(T const& value) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return { reinterpret_cast<uint8_t const*>(&value), sizeof(T) };
+}
+
+std::span<uint8_t const> bytes_of(std::string_view value) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return { reinterpret_cast<uint8_t const*>(value.data()), value.size() };
+}
+
+}  // namespace
+
+namespace failure_cache {
+
+bool KeyBuilder::add(std::filesystem::path const& path) noexcept {
+  auto const& name = path.native();
+  hasher.update(bytes_of(name.size()));
+  hasher.update(bytes_of(std::string_view(name)));
+  if (auto hash = staging::verified_hash_of(path)) {
+    hasher.update(bytes_of('h'));
+    hasher.update(bytes_of(*hash));
+    return true;
+  }
+  // A memfd is a new inode every launch, without a hash there is nothing stable to identify it by
+  if (staging::find_memfd(path) != nullptr) {
+    return false;
+  }
+  struct stat64 st {};
+  if (stat64(path.c_str(), &st) != 0) {
+    return false;
+  }
+  auto identity = staging::identity_of(st);
+  std::array<uint64_t, 3> fields{ identity.size, static_cast<uint64_t>(identity.mtime), identity.inode };
+  hasher.update(bytes_of('i'));
+  hasher.update(bytes_of(fields));
+  return true;
+}
+
+void KeyBuilder::addMissing(std::string_view name) noexcept {
+  hasher.update(bytes_of(name.size()));
+  hasher.update(bytes_of(name));
+  hasher.update(bytes_of('m'));
+}
+
+void KeyBuilder::addValue(std::string_view value) noexcept {
+  hasher.update(bytes_of(value.size()));
+  hasher.update(bytes_of(value));
+  hasher.update(bytes_of('v'));
+}
+
+void load(std::filesystem::path const& path, uint64_t environment) noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  cache.path = path;
+  cache.environment = environment;
+  cache.entries.clear();
+  cache.changed = false;
+  std::ifstream file(path);
+  if (!file) {
+    LOG_DEBUG("No failure cache at: {}", path.c_str());
+    return;
+  }
+  // Each line is: <path>\t<key>\t<failure>, where the key is hex
+  std::string line;
+  uint64_t written_environment{};
+  if (!std::getline(file, line) || !line.starts_with(kCacheHeader) || line.size() <= kCacheHeader.size() ||
+      line[kCacheHeader.size()] != '\t' ||
+      !(std::istringstream(line.substr(kCacheHeader.size() + 1)) >> std::hex >> written_environment)) {
+    LOG_INFO("Discarding failure cache: {} written by another version", path.c_str());
+    return;
+  }
+  if (written_environment != environment) {
+    // The game or the modloader changed, every failure may have been fixed by it
+    LOG_INFO("Discarding failure cache: {} written under another environment", path.c_str());
+    cache.changed = true;
+    return;
+  }
+  while (std::getline(file, line)) {
+    auto first = line.find('\t');
+    auto second = first == std::string::npos ? std::string::npos : line.find('\t', first + 1);
+    CacheEntry entry{};
+    if (second == std::string::npos ||
+        !(std::istringstream(line.substr(first + 1, second - first - 1)) >> std::hex >> entry.key)) {
+      LOG_WARN("Discarding malformed failure cache: {}", path.c_str());
+      cache.entries.clear();
+      return;
+    }
+    entry.failure = line.substr(second + 1);
+    entry.persisted = true;
+    cache.entries.insert_or_assign(line.substr(0, first), std::move(entry));
+  }
+  LOG_DEBUG("Read {} entries from failure cache: {}", cache.entries.size(), path.c_str());
+}
+
+bool contains(std::filesystem::path const& path) noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  auto it = cache.entries.find(path.string());
+  return it != cache.entries.end() && it->second.persisted;
+}
+
+std::optional<std::string> find(std::filesystem::path const& path, uint64_t key) noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  auto it = cache.entries.find(path.string());
+  if (it == cache.entries.end() || !it->second.persisted || it->second.key != key) {
+    return std::nullopt;
+  }
+  it->second.used = true;
+  return it->second.failure;
+}
+
+void record(std::filesystem::path const& path, uint64_t key, std::string_view failure) noexcept {
+  CacheEntry entry{ .key = key, .failure = std::string(failure), .used = true, .persisted = false };
+  // One failure per line
+  std::replace_if(
+      entry.failure.begin(), entry.failure.end(), [](char c) { return c == '\n' || c == '\r'; }, ' ');
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  cache.entries.insert_or_assign(path.string(), std::move(entry));
+  cache.changed = true;
+}
+
+void forget(std::filesystem::path const& path) noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  if (cache.entries.erase(path.string()) != 0) {
+    cache.changed = true;
+  }
+}
+
+bool save() noexcept {
+  auto& cache = get_cache();
+  std::unique_lock lock(cache.mutex);
+  auto all_used = std::all_of(cache.entries.begin(), cache.entries.end(),
+                              [](auto const& pair) { return pair.second.used; });
+  if (!cache.changed && all_used) {
+    return true;
+  }
+  if (cache.path.empty()) {
+    return false;
+  }
+  auto tmp = cache.path;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file) {
+      LOG_ERROR("Failed to open failure cache: {} for writing", tmp.c_str());
+      return false;
+    }
+    file << kCacheHeader << '\t' << std::hex << cache.environment << '\n';
+    for (auto const& [path, entry] : cache.entries) {
+      if (entry.used) {
+        file << path << '\t' << entry.key << '\t' << entry.failure << '\n';
+      }
+    }
+    if (!file.flush()) {
+      LOG_ERROR("Failed to write failure cache: {}", tmp.c_str());
+      return false;
+    }
+  }
+  std::error_code error_code;
+  std::filesystem::rename(tmp, cache.path, error_code);
+  if (error_code) {
+    LOG_ERROR("Failed to replace failure cache: {}: {}", cache.path.c_str(), error_code.message().c_str());
+    return false;
+  }
+  // What is on disk now matches what is in memory
+  cache.changed = false;
+  std::erase_if(cache.entries, [](auto const& pair) { return !pair.second.used; });
+  return true;
+}
+
+}  // namespace failure_cache
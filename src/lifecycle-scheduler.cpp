@@ -0,0 +1,456 @@
+#include "lifecycle-scheduler.hpp"
+#include "config.hpp"
+#include "dependency-graph.hpp"
+#include "id-map.hpp"
+#include "log.h"
+#include "string-interner.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace modloader {
+
+namespace {
+
+// Whether this thread is a worker of a schedule, rather than the thread that started it
+thread_local bool on_worker = false;
+
+// The mods with a lifecycle call running, so that nothing else starts the same call meanwhile
+std::mutex running_mutex;
+std::condition_variable call_finished;
+std::unordered_set<LoadedMod const*> running_calls;
+
+/// @brief The setup of a mod that is not thread safe, which a setup worker hands to the thread that started it
+struct Handoff {
+  LoadedMod* mod;
+  bool done = false;
+  bool result = false;
+};
+// Guarded by running_mutex, call_finished is notified once one is done
+std::deque<Handoff*> handoffs;
+// Whether this thread started the setup workers, and so makes the setups they hand off
+thread_local bool serving_handoffs = false;
+
+/// @brief Whether a worker is waiting for this thread to make a setup. Takes running_mutex if this thread serves them.
+[[nodiscard]] bool handoffsPending() noexcept {
+  if (!serving_handoffs) {
+    return false;
+  }
+  std::unique_lock lock(running_mutex);
+  return !handoffs.empty();
+}
+
+/// @brief Makes the setups workers have handed to this thread, if it is the one that started them
+void serveHandoffs() noexcept {
+  if (!serving_handoffs) {
+    return;
+  }
+  std::unique_lock lock(running_mutex);
+  while (!handoffs.empty()) {
+    auto* handoff = handoffs.front();
+    handoffs.pop_front();
+    lock.unlock();
+    auto result = setupNow(*handoff->mod);
+    lock.lock();
+    handoff->result = result;
+    handoff->done = true;
+    call_finished.notify_all();
+  }
+}
+
+/// @brief Makes call on mod, unless called says it has been made already. Waits for any call running on mod first.
+template <typename F>
+bool callOnce(LoadedMod& mod, bool const& called, F&& call) {
+  {
+    std::unique_lock lock(running_mutex);
+    while (true) {
+      call_finished.wait(lock,
+                         [&] { return !running_calls.contains(&mod) || (serving_handoffs && !handoffs.empty()); });
+      if (!running_calls.contains(&mod)) {
+        break;
+      }
+      // The call waited for may itself be waiting for this thread to make a setup it handed off
+      lock.unlock();
+      serveHandoffs();
+      lock.lock();
+    }
+    if (called) {
+      return true;
+    }
+    running_calls.insert(&mod);
+  }
+  auto result = call();
+  {
+    std::unique_lock lock(running_mutex);
+    running_calls.erase(&mod);
+  }
+  call_finished.notify_all();
+  return result;
+}
+
+/// @brief The mods in indices that mod depends on, directly or through objects that are not in indices
+/// @param indices The interned path of every mod to look for, to its index
+std::vector<uint32_t> dependenciesOf(LoadedMod const& mod, IdMap<uint32_t> const& indices,
+                                     std::filesystem::path const& dependencyDir) {
+  std::vector<uint32_t> dependencies{};
+  IdSet visited{};
+  std::vector<std::pair<std::filesystem::path const*, LoadPhase>> stack{};
+  stack.emplace_back(&mod.object.path, mod.phase);
+  while (!stack.empty()) {
+    auto [path, phase] = stack.back();
+    stack.pop_back();
+    // Scanned while the phase was planned unless the scans were cleared since, then only the metadata cache is read
+    for (auto const& [dependency, dependencyPhase] : getScanned(*path, dependencyDir, phase).needed) {
+      auto id = intern_path(dependency);
+      if (!visited.insert(id)) {
+        continue;
+      }
+      if (auto const* index = indices.find(id)) {
+        // Whatever it depends on is waited for through it
+        dependencies.push_back(*index);
+        continue;
+      }
+      stack.emplace_back(&dependency, dependencyPhase);
+    }
+  }
+  return dependencies;
+}
+
+/// @brief Makes one lifecycle call on a list of mods in dependency order, some on a pool of workers and the rest in
+/// order on the calling thread. Every call only waits for calls on earlier mods, so the two sides cannot deadlock.
+class Schedule {
+ public:
+  using Call = bool (*)(LoadedMod&) noexcept;
+
+  /// @brief Starts the calls on workers that wait for nothing
+  /// @param onWorker Which mods are called on a worker
+  /// @param name The name of the call, for logging
+  Schedule(std::span<LoadedMod* const> mods, std::vector<bool> onWorker, std::filesystem::path const& dependencyDir,
+           Call call, char const* name)
+      : mods(mods.begin(), mods.end()),
+        onWorker(std::move(onWorker)),
+        dependencyDir(dependencyDir),
+        waiting(mods.size()),
+        dependents(mods.size()),
+        called(mods.size()),
+        remaining(mods.size()),
+        call(call),
+        name(name) {
+    for (uint32_t i = 0; i < mods.size(); i++) {
+      indices.try_emplace(intern_path(mods[i]->object.path), i);
+    }
+    size_t workerCount = 0;
+    std::vector<uint32_t> ready{};
+    for (uint32_t i = 0; i < mods.size(); i++) {
+      // Mods only ever depend on earlier ones, since dependencies are opened first, so edges to later mods can only
+      // come from cycles and are dropped
+      auto dependencies = dependenciesOf(*mods[i], indices, dependencyDir);
+      std::erase_if(dependencies, [i](uint32_t dependency) { return dependency >= i; });
+      waiting[i] = static_cast<uint32_t>(dependencies.size());
+      for (auto dependency : dependencies) {
+        dependents[dependency].push_back(i);
+      }
+      if (this->onWorker[i]) {
+        workerCount++;
+        if (waiting[i] == 0) {
+          ready.push_back(i);
+        }
+      }
+    }
+    pool.emplace(std::min<size_t>(workerCount, std::max(1U, std::thread::hardware_concurrency())));
+    for (auto index : ready) {
+      pool->submit([this, index] { runOnWorker(index); });
+    }
+  }
+  Schedule(Schedule const&) = delete;
+  Schedule& operator=(Schedule const&) = delete;
+
+  /// @brief Makes the calls that are not made on a worker, in order, waiting for the calls they depend on first
+  void runOnCaller() {
+    for (uint32_t i = 0; i < mods.size(); i++) {
+      if (onWorker[i]) {
+        continue;
+      }
+      {
+        std::unique_lock lock(mutex);
+        waitServing(lock, [&] { return waiting[i] == 0; });
+      }
+      makeCall(i);
+      finish(i);
+    }
+  }
+  /// @brief Blocks until every call has finished, including the calls on the calling thread
+  void wait() {
+    std::unique_lock lock(mutex);
+    waitServing(lock, [&] { return remaining == 0; });
+  }
+  /// @brief Has the thread that started this schedule make the setup of mod, and waits for it. For a worker that must
+  /// not set up mod itself. The thread makes it the next time it waits, or once the call it is in returns.
+  bool handOff(LoadedMod& mod) {
+    Handoff handoff{ &mod };
+    {
+      std::unique_lock lock(running_mutex);
+      handoffs.push_back(&handoff);
+    }
+    call_finished.notify_all();
+    {
+      // Taken so the notification cannot slip in between the caller checking for handoffs and it starting to wait
+      std::unique_lock lock(mutex);
+    }
+    finished.notify_all();
+    std::unique_lock lock(running_mutex);
+    call_finished.wait(lock, [&] { return handoff.done; });
+    return handoff.result;
+  }
+  /// @brief Whether this schedule makes setup calls, whose thread serves handoffs
+  [[nodiscard]] bool setsUp() const noexcept {
+    return call == setupNow;
+  }
+  /// @brief The schedule the calling thread is inside a call of, if any
+  [[nodiscard]] static Schedule* calling() noexcept {
+    return current;
+  }
+  [[nodiscard]] bool done() {
+    std::unique_lock lock(mutex);
+    return remaining == 0;
+  }
+  [[nodiscard]] size_t workers() const noexcept {
+    return pool->size();
+  }
+  /// @brief Whether the calling thread is inside one of the calls of this schedule, which @ref wait would wait for
+  [[nodiscard]] bool insideCall() const noexcept {
+    return current == this;
+  }
+  /// @brief Blocks until the calls on every mod of this schedule that mod depends on have finished, for a mod that is
+  /// not part of it. From inside a call, only the calls on earlier mods are waited for: only they are sure not to wait
+  /// for the call the thread is in.
+  void waitForDependencies(LoadedMod const& mod) {
+    auto dependencies = dependenciesOf(mod, indices, dependencyDir);
+    if (insideCall()) {
+      std::erase_if(dependencies, [this](uint32_t dependency) {
+        if (dependency < currentIndex) {
+          return false;
+        }
+        LOG_WARN("Not waiting for {} on: {}, it is called after the mod calling it", name,
+                 mods[dependency]->object.path.c_str());
+        return true;
+      });
+    }
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [&] {
+      return std::ranges::all_of(dependencies, [this](uint32_t dependency) { return called[dependency]; });
+    });
+  }
+
+ private:
+  /// @brief Waits on finished until done returns true, making the setups workers hand off meanwhile
+  template <typename F>
+  void waitServing(std::unique_lock<std::mutex>& lock, F&& done) {
+    while (true) {
+      finished.wait(lock, [&] { return done() || handoffsPending(); });
+      if (!handoffsPending()) {
+        return;
+      }
+      lock.unlock();
+      serveHandoffs();
+      lock.lock();
+    }
+  }
+  void makeCall(uint32_t index) {
+    current = this;
+    currentIndex = index;
+    if (!call(*mods[index])) {
+      LOG_INFO("No {} function on mod: {}", name, mods[index]->object.path.c_str());
+    }
+    current = nullptr;
+  }
+  void runOnWorker(uint32_t index) {
+    LOG_DEBUG("Calling {} on: {} on a worker", name, mods[index]->object.path.c_str());
+    on_worker = true;
+    makeCall(index);
+    finish(index);
+  }
+  void finish(uint32_t index) {
+    std::vector<uint32_t> ready{};
+    {
+      std::unique_lock lock(mutex);
+      remaining--;
+      called[index] = true;
+      for (auto dependent : dependents[index]) {
+        if (--waiting[dependent] == 0 && onWorker[dependent]) {
+          ready.push_back(dependent);
+        }
+      }
+    }
+    finished.notify_all();
+    for (auto dependent : ready) {
+      pool->submit([this, dependent] { runOnWorker(dependent); });
+    }
+  }
+
+  static thread_local Schedule* current;
+  // The index of the mod the call current is making is on
+  static thread_local uint32_t currentIndex;
+
+  std::vector<LoadedMod*> mods;
+  std::vector<bool> onWorker;
+  std::filesystem::path dependencyDir;
+  // The interned path of every mod, to its index
+  IdMap<uint32_t> indices;
+  std::mutex mutex;
+  std::condition_variable finished;
+  // The number of dependencies of each mod whose call has not finished yet
+  std::vector<uint32_t> waiting;
+  std::vector<std::vector<uint32_t>> dependents;
+  // Whether the call on each mod has finished
+  std::vector<bool> called;
+  // The number of calls that have not finished yet
+  size_t remaining;
+  Call call;
+  char const* name;
+  // Last, so that it finishes the calls it has queued before anything they use is destroyed
+  std::optional<ThreadPool> pool;
+};
+
+thread_local Schedule* Schedule::current = nullptr;
+thread_local uint32_t Schedule::currentIndex = 0;
+
+// The late_loads started by lateLoadMods, kept until the next lateLoadMods or for the rest of the process
+std::mutex late_loads_mutex;
+std::shared_ptr<Schedule> late_loads;
+
+}  // namespace
+
+bool setupNow(LoadedMod& mod) noexcept {
+  if (on_worker && !policy_of(mod.object.path).threadSafe) {
+    auto* schedule = Schedule::calling();
+    if (schedule != nullptr && schedule->setsUp()) {
+      LOG_DEBUG("Handing setup on: {} to the thread that started the workers, it is not thread safe",
+                mod.object.path.c_str());
+      return schedule->handOff(mod);
+    }
+    // A late_load worker has nothing to hand it to, the thread that started it has moved on. Only waits for a setup
+    // that is already running elsewhere.
+    return callOnce(mod, mod.inited, [&mod] {
+      LOG_ERROR("Not calling setup on: {} from a late_load worker, it is not thread safe", mod.object.path.c_str());
+      return false;
+    });
+  }
+  return callOnce(mod, mod.inited, [&mod] { return mod.init(); });
+}
+
+bool onLifecycleWorker() noexcept {
+  return on_worker;
+}
+
+bool lateLoadNow(LoadedMod& mod) noexcept {
+  return callOnce(mod, mod.late_load_called, [&mod] { return mod.late_load(); });
+}
+
+void setupMods(std::span<LoadResult> results, std::filesystem::path const& dependencyDir) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<LoadedMod*> mods{};
+  std::vector<bool> onWorker{};
+  for (auto& result : results) {
+    if (auto* loaded_mod = std::get_if<LoadedMod>(&result)) {
+      mods.push_back(loaded_mod);
+      onWorker.push_back(!loaded_mod->inited && policy_of(loaded_mod->object.path).threadSafe);
+    } else if (auto* fail = std::get_if<FailedMod>(&result)) {
+      LOG_WARN("Skipping setup call on: {} because it failed: {}", fail->object.path.c_str(), fail->failure.c_str());
+    }
+  }
+  auto workerCount = std::count(onWorker.begin(), onWorker.end(), true);
+  if (workerCount == 0) {
+    for (auto* mod : mods) {
+      if (!setupNow(*mod)) {
+        // Setup call does not exist, but the mod was still loaded
+        LOG_INFO("No setup on mod: {}", mod->object.path.c_str());
+      }
+    }
+    return;
+  }
+
+  // Workers may hand off setups as soon as they start
+  serving_handoffs = true;
+  Schedule schedule(mods, std::move(onWorker), dependencyDir, setupNow, "setup");
+  schedule.runOnCaller();
+  schedule.wait();
+  serving_handoffs = false;
+  LOG_INFO("Set up: {} mods, {} of them on: {} workers, in {}us", mods.size(), workerCount, schedule.workers(),
+           std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void lateLoadMods(std::span<LoadedMod* const> mods, std::filesystem::path const& dependencyDir) {
+  std::vector<bool> onWorker{};
+  onWorker.reserve(mods.size());
+  for (auto const* mod : mods) {
+    onWorker.push_back(!mod->late_load_called && policy_of(mod->object.path).asyncLateLoad);
+  }
+  auto workerCount = std::count(onWorker.begin(), onWorker.end(), true);
+  if (workerCount == 0) {
+    for (auto* mod : mods) {
+      LOG_DEBUG("Attempting to call late_load on mod: {}", mod->object.path.c_str());
+      if (!lateLoadNow(*mod)) {
+        // Late load call does not exist, but the mod was still loaded
+        LOG_INFO("No late_load function on mod: {}", mod->object.path.c_str());
+      }
+    }
+    return;
+  }
+
+  auto schedule = std::make_shared<Schedule>(mods, std::move(onWorker), dependencyDir, lateLoadNow, "late_load");
+  {
+    std::unique_lock lock(late_loads_mutex);
+    late_loads = schedule;
+  }
+  LOG_INFO("Calling late_load on: {} of: {} mods in the background", workerCount, mods.size());
+  schedule->runOnCaller();
+}
+
+void awaitLateLoads() noexcept {
+  std::shared_ptr<Schedule> schedule{};
+  {
+    std::unique_lock lock(late_loads_mutex);
+    schedule = late_loads;
+  }
+  if (schedule == nullptr) {
+    return;
+  }
+  if (schedule->insideCall()) {
+    LOG_WARN("Not waiting for late_loads from inside a late_load, it would wait for itself");
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  schedule->wait();
+  LOG_DEBUG("Waited: {}us for late_loads",
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+bool lateLoadAfterDependencies(LoadedMod& mod) noexcept {
+  std::shared_ptr<Schedule> schedule{};
+  {
+    std::unique_lock lock(late_loads_mutex);
+    schedule = late_loads;
+  }
+  if (schedule != nullptr) {
+    schedule->waitForDependencies(mod);
+  }
+  return lateLoadNow(mod);
+}
+
+bool lateLoadsFinished() noexcept {
+  std::unique_lock lock(late_loads_mutex);
+  return late_loads == nullptr || late_loads->done();
+}
+
+}  // namespace modloader
@@ -1,21 +1,39 @@
 #include "loader.hpp"
+#include "config.hpp"
 #include "constexpr-map.hpp"
+#include "dependency-graph.hpp"
+#include "directory-index.hpp"
+#include "elf-metadata.hpp"
 #include "elf-utils.hpp"
+#include "failure-cache.hpp"
 #include "internal-loader.hpp"
 #include "log.h"
 #include "modloader.h"
-
+#include "prefetcher.hpp"
+#include "staging.hpp"
+#include "symbol-check.hpp"
+#include "thread-pool.hpp"
+
+#ifndef LINUX_TEST
+#include <android/dlext.h>
+#endif
 #include <dlfcn.h>
 #include <elf.h>
 #include <fcntl.h>
+#include <link.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
@@ -28,13 +46,18 @@
 namespace modloader {
 
 using namespace elf_utils;
-/// @brief Find and create a SharedObject representing the resolved dependency, if it can be found.
-/// @param dependencyDir The top level directory
-/// @param phase The load phase of the dependency to start the search from
-/// @param name The dependency's name to open
-/// @return The returned pair on success, nullopt otherwise
+
 std::optional<std::pair<SharedObject, LoadPhase>> findSharedObject(std::filesystem::path const& dependencyDir,
                                                                    LoadPhase phase, std::filesystem::path const& name) {
+  if (!name.has_parent_path()) {
+    // Plain filenames are answered from the index, without touching the filesystem
+    auto index = get_directory_index(dependencyDir);
+    if (auto const* file = index->find(phase, name.native())) {
+      LOG_DEBUG("Found dependency: {} at: {}", name.c_str(), file->path.c_str());
+      return { std::make_pair(SharedObject(file->path), file->phase) };
+    }
+    return { { SharedObject(name), LoadPhase::None } };
+  }
   // Search in reverse load order, starting at phase
   std::error_code error_code;
   for (auto const& it : loadPhaseMap.arr) {
@@ -43,6 +66,12 @@ std::optional<std::pair<SharedObject, LoadPhase>> findSharedObject(std::filesyst
     }
     auto path_to_check = dependencyDir / it.second / name;
     LOG_DEBUG("Searching for dependency: {} at: {}", name.c_str(), path_to_check.c_str());
+    if (staging::memfd_staged()) {
+      if (staging::find_memfd(path_to_check) != nullptr) {
+        return { std::make_pair(SharedObject(path_to_check), it.first) };
+      }
+      continue;
+    }
     if (std::filesystem::exists(path_to_check, error_code)) {
       // Dependency exists at this phase.
       // TODO: This should actually check to ensure that this file is actually readable, not just exists
@@ -61,136 +90,61 @@ std::optional<std::pair<SharedObject, LoadPhase>> findSharedObject(std::filesyst
 
 std::vector<DependencyResult> SharedObject::getToLoad(
     std::filesystem::path const& dependencyDir, LoadPhase phase,
-    std::unordered_map<std::string_view, std::vector<DependencyResult>>& loadedDependencies) const {
-  auto depIt = loadedDependencies.find(path.c_str());
-  LOG_DEBUG("Getting dependencies for: {} under root: {} for phase: {}", path.c_str(), dependencyDir.c_str(), phase);
-
-  if (depIt != loadedDependencies.end()) {
-    LOG_DEBUG("Hit in dependencies cache, have {} loaded dependencies", depIt->second.size());
-    return depIt->second;
-  }
-
-  // TODO: RAII-ify this
-  int fd = open64(path.c_str(), O_RDONLY | O_CLOEXEC);
-  if (fd == -1) {
-    LOG_ERROR("Failed to open dependency: {}: {}", path.c_str(), std::strerror(errno));
-    return {};
-  }
+    std::unordered_map<std::string_view, std::vector<DependencyResult>>& /*loadedDependencies*/) const {
+  SharedObject const roots[] = { SharedObject(path) };
+  return dependencyTree(DependencyGraph::build(roots, dependencyDir, phase).nodesOf(0));
+}
 
-  struct stat64 st {};
-  if (fstat64(fd, &st) != 0) {
-    LOG_ERROR("Failed to stat dependency: {}: {}", path.c_str(), std::strerror(errno));
+std::vector<DependencyResult> dependencyTree(std::span<DependencyNode const> nodes) {
+  if (nodes.empty()) {
     return {};
   }
-  size_t size = st.st_size;
-
-  LOG_DEBUG("mmapping with size: {} on fd: {}", size, fd);
-  // TODO: RAII-ify this
-  void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
-
-  if (mapped == MAP_FAILED) {
-    LOG_ERROR("Failed to mmap dependency: {}: {}", path.c_str(), std::strerror(errno));
-  }
-
-  std::span<uint8_t> f(static_cast<uint8_t*>(mapped), static_cast<uint8_t*>(mapped) + size);
-
-  auto elf = readAtOffset<Elf64_Ehdr>(f, 0);
-  LOG_DEBUG("Header read: ehsize: {}, type: {}, version: {}, shentsize: {}", elf.e_ehsize, elf.e_type, elf.e_version,
-            elf.e_shentsize);
-
-  // Using the c_str here is OK because the lifetime of the path is tied to this instance
-  std::vector<DependencyResult>& dependencies =
-      loadedDependencies.emplace(path.c_str(), std::vector<DependencyResult>{}).first->second;
-  // Micro-optimization: Small dependency sets will not alloc, larger ones will alloc less frequently
-  constexpr static auto kGuessDependencyCount = 16;
-  dependencies.reserve(kGuessDependencyCount);
-
-  auto sections = readManyAtOffset<Elf64_Shdr>(f, elf.e_shoff, elf.e_shnum, elf.e_shentsize);
-
-  for (auto const& sectionHeader : sections) {
-    if (sectionHeader.sh_type != SHT_DYNAMIC) {
-      continue;
+  // Every path through the graph becomes its own subtree, nodes that are reached again while they are still being
+  // built get what they hold so far. Walked with an explicit stack, so that extremely nested trees cannot overflow the
+  // call stack.
+  std::unordered_map<uint32_t, std::vector<DependencyResult>> built{};
+  struct Frame {
+    std::span<uint32_t const> needed;
+    std::vector<DependencyResult>* results;
+    size_t next;
+  };
+  std::vector<Frame> stack{};
+  // The result of a node that needed no frame, or whose frame just finished
+  std::optional<std::vector<DependencyResult>> finished{};
+  auto enter = [&](uint32_t node) {
+    if (auto it = built.find(node); it != built.end()) {
+      finished.emplace(it->second);
+      return;
     }
-    // sectionHeader is the dynamic symbols table
-    // We must walk until we see a NULL symbol
-    // We want to grab the STRTAB entry from here and use it
-    // The number of entries we have seen, mostly for debugging
-    int dynamic_count = 0;
-    // This vector holds the actual string table offsets for the DT_NEEDED entries
-    std::vector<uint64_t> needed_offsets{};
-    // The strtab offset to use for name resolution
-    uint64_t strtab_offset = 0;
-    needed_offsets.reserve(kGuessDependencyCount);
-    while (true) {
-      // Get the dynamic symbol for this entry
-      auto const& dyn = readAtOffset<Elf64_Dyn>(f, sectionHeader.sh_offset + sizeof(Elf64_Dyn) * dynamic_count++);
-      if (dyn.d_tag == DT_NULL) {
-        LOG_DEBUG(
-            "End of dynamic section. Counted a total of: {} dynamic entries, of which {} were needed dependencies",
-            dynamic_count, needed_offsets.size());
-        break;
-      }
-      if (dyn.d_tag == DT_NEEDED) {
-        LOG_DEBUG("Found DT_NEEDED entry: {} with string table offset: {}", dynamic_count - 1, dyn.d_un.d_val);
-        needed_offsets.push_back(dyn.d_un.d_val);
-      } else if (dyn.d_tag == DT_STRTAB) {
-        strtab_offset = dyn.d_un.d_ptr;
-      }
+    stack.push_back(Frame{ .needed = nodes[node].needed, .results = &built[node], .next = 0 });
+  };
+  enter(0);
+  while (!stack.empty()) {
+    auto& frame = stack.back();
+    if (finished) {
+      auto dep = frame.needed[frame.next++];
+      frame.results->emplace_back(std::in_place_type_t<Dependency>{}, SharedObject(nodes[dep].object),
+                                  std::move(*finished));
+      finished.reset();
     }
-    if (strtab_offset == 0) {
-      // We failed to read a DT_STRTAB entry from the dynamic section!
-      LOG_DEBUG("Failed to find pointer to strtab! No DT_STRTAB section in: {}", path.c_str());
-      if (munmap(mapped, size) != 0) {
-        LOG_ERROR("Failed to munmap {}: {}", path.c_str(), std::strerror(errno));
-      }
-      if (close(fd) != 0) {
-        LOG_ERROR("Failed to close fd for: {}: {}", path.c_str(), std::strerror(errno));
-      }
-      return dependencies;
+    if (frame.next == frame.needed.size()) {
+      finished.emplace(*frame.results);
+      stack.pop_back();
+      continue;
     }
-    for (auto needed_offset : needed_offsets) {
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-      std::string_view name = &readAtOffset<char const>(f, strtab_offset + needed_offset);
-
-      if (name.empty()) {
-        LOG_WARN("DT_NEEDED str is null! Bad ELF: {}, but continuing anyways...", path.c_str());
-        continue;
-      }
-      LOG_DEBUG("DT_NEEDED name: {}", name);
-
-      auto optObj = findSharedObject(dependencyDir, phase, name);
-
-      if (optObj) {
-        auto [obj, openedPhase] = std::move(*optObj);
-        if (openedPhase == LoadPhase::None) {
-          LOG_DEBUG("Unresolved dependency for: {}", obj.path.c_str());
-          // Unresolved dependency
-          dependencies.emplace_back(std::in_place_type_t<MissingDependency>{}, std::move(obj));
-        } else {
-          LOG_DEBUG("Resolved dependency for: {}", obj.path.c_str());
-          // Resolved dependency
-          // TODO: Make this avoid potentially stack overflowing on extremely nested dependency trees
-          auto loadList = obj.getToLoad(dependencyDir, openedPhase, loadedDependencies);
-          dependencies.emplace_back(std::in_place_type_t<Dependency>{}, std::move(obj), loadList);
-        }
-      } else {
-        // Failed dependency (failed to check if it exists?)
-        LOG_WARN("Skipping FAILED dependency: {}", name.data());
-      }
+    auto dep = frame.needed[frame.next];
+    if (dep >= nodes.size()) {
+      frame.next++;
+      continue;
     }
-    // Because there is only one dynamic table, once we see it, we can just exit right away.
-    break;
-  }
-
-  if (munmap(mapped, size) != 0) {
-    LOG_ERROR("Failed to munmap {}: {}", path.c_str(), std::strerror(errno));
-  }
-  if (close(fd) != 0) {
-    LOG_ERROR("Failed to close fd for: {}: {}", path.c_str(), std::strerror(errno));
+    if (nodes[dep].missing) {
+      frame.results->emplace_back(std::in_place_type_t<MissingDependency>{}, nodes[dep].object);
+      frame.next++;
+      continue;
+    }
+    enter(dep);
   }
-  LOG_DEBUG("Found a total of: {} dependencies successfully for: {}", dependencies.size(), path.c_str());
-
-  return dependencies;
+  return std::move(*finished);
 }
 
 std::optional<std::string> LoadedMod::close() const noexcept {
@@ -228,35 +182,97 @@ void sortDependencies(std::span<DependencyResult> deps) {
   });
 }
 
-// https://www.geeksforgeeks.org/cpp-program-for-topological-sorting/
-// Use mutable ref to avoid making a new vector that is sorted
+namespace {
+
+enum struct VisitState : uint8_t {
+  // Entered, but not all of its dependencies have been sorted yet
+  Active,
+  Done,
+};
 
-/// @brief Performs a recursive topological sort for the given dependency, stack, and visited collection.
-/// @param main The dependency to sort through. Must outlive the visited set
+/// @brief Performs an iterative depth first topological sort for the given dependency, stack, and visited collection.
+/// Dependencies are walked in descending path order and each one is placed after all of its own dependencies.
+/// A dependency on an object that is still active is a cycle. It is reported and otherwise ignored.
+/// @param root The dependency to sort through. Must outlive the visited set
 /// @param stack The stack to track the sorted dependencies
-/// @param visited The set of all visited paths
-void topologicalSortRecurse(Dependency& main, std::deque<Dependency>& stack,
-                            std::unordered_set<std::string_view>& visited) {
-  if (visited.contains(main.object.path.c_str())) {
+/// @param visited The state of all visited paths
+/// @param cycles Each cycle found is appended here
+void topologicalSortFrom(Dependency& root, std::deque<Dependency>& stack,
+                         std::unordered_map<std::string_view, VisitState>& visited,
+                         std::vector<DependencyCycle>& cycles) {
+  if (visited.contains(root.object.path.c_str())) {
     return;
   }
-
-  visited.emplace(main.object.path.c_str());
-  sortDependencies(main.dependencies);
-
-  for (auto& depResult : main.dependencies) {
-    auto* dep = get_if<Dependency>(&depResult);
-    if (dep == nullptr) {
+  struct Frame {
+    Dependency* dep;
+    size_t next;
+  };
+  std::vector<Frame> frames{};
+  auto enter = [&](Dependency& dep) {
+    visited.emplace(dep.object.path.c_str(), VisitState::Active);
+    // Each object is entered once, so its dependencies are only ever sorted once
+    sortDependencies(dep.dependencies);
+    frames.push_back(Frame{ .dep = &dep, .next = 0 });
+  };
+  enter(root);
+  while (!frames.empty()) {
+    auto& frame = frames.back();
+    auto& dependencies = frame.dep->dependencies;
+    Dependency* child = nullptr;
+    while (child == nullptr && frame.next < dependencies.size()) {
+      child = get_if<Dependency>(&dependencies[frame.next++]);
+    }
+    if (child == nullptr) {
+      visited[frame.dep->object.path.c_str()] = VisitState::Done;
+      stack.emplace_back(*frame.dep);
+      frames.pop_back();
       continue;
     }
-    topologicalSortRecurse(*dep, stack, visited);
+    auto it = visited.find(child->object.path.c_str());
+    if (it == visited.end()) {
+      enter(*child);
+    } else if (it->second == VisitState::Active) {
+      auto start = std::find_if(frames.begin(), frames.end(),
+                                [&](Frame const& f) { return f.dep->object.path == child->object.path; });
+      auto& cycle = cycles.emplace_back();
+      for (; start != frames.end(); ++start) {
+        cycle.objects.push_back(start->dep->object.path);
+      }
+    }
   }
+}
 
-  stack.emplace_back(main);
+void logCycles(std::span<DependencyCycle const> cycles) {
+  for (auto const& cycle : cycles) {
+    std::string description{};
+    for (auto const& object : cycle.objects) {
+      description += object.filename().string();
+      description += " -> ";
+    }
+    description += cycle.objects.front().filename().string();
+    LOG_WARN("Dependency cycle: {}, the order within it is arbitrary", description.c_str());
+  }
 }
 
+}  // namespace
+
 // Copies FROM list into the dependencies
 std::deque<Dependency> topologicalSort(std::span<DependencyResult const> list) {
+  std::vector<DependencyCycle> cycles{};
+  auto sorted = topologicalSort(list, cycles);
+  logCycles(cycles);
+  return sorted;
+}
+
+// Moves FROM list
+std::deque<Dependency> topologicalSort(std::vector<Dependency>&& list) {
+  std::vector<DependencyCycle> cycles{};
+  auto sorted = topologicalSort(std::move(list), cycles);
+  logCycles(cycles);
+  return sorted;
+}
+
+std::deque<Dependency> topologicalSort(std::span<DependencyResult const> list, std::vector<DependencyCycle>& cycles) {
   std::vector<Dependency> deps;
   deps.reserve(list.size());
 
@@ -269,78 +285,141 @@ std::deque<Dependency> topologicalSort(std::span<DependencyResult const> list) {
     deps.push_back(*dep);
   }
 
-  return topologicalSort(std::move(deps));
+  return topologicalSort(std::move(deps), cycles);
 }
 
-// Moves FROM list
-std::deque<Dependency> topologicalSort(std::vector<Dependency>&& list) {
+std::deque<Dependency> topologicalSort(std::vector<Dependency>&& list, std::vector<DependencyCycle>& cycles) {
   std::deque<Dependency> dependencies{};
-  std::unordered_set<std::string_view> visited{};
+  std::unordered_map<std::string_view, VisitState> visited{};
 
   sortDependencies(list);
 
   for (Dependency& dep : list) {
-    topologicalSortRecurse(dep, dependencies, visited);
+    topologicalSortFrom(dep, dependencies, visited, cycles);
   }
 
   return dependencies;
 }
 
-std::vector<SharedObject> listAllObjectsInPhase(std::filesystem::path const& dependencyDir, LoadPhase phase) {
-  std::error_code error_code;
-  // Note: We see through this iteration at compile time
+std::unordered_set<std::string> findUnreachableLibs(std::filesystem::path const& dependencyDir) {
+  std::filesystem::path libs_dir;
   for (auto const& [ph, path] : loadPhaseMap.arr) {
-    if (ph != phase) {
+    if (ph == LoadPhase::Libs) {
+      libs_dir = dependencyDir / path;
+    }
+  }
+  std::unordered_set<std::string> reachable{};
+  auto& pool = ThreadPool::shared();
+  for (auto phase : { LoadPhase::EarlyMods, LoadPhase::Mods }) {
+    auto mods = listAllObjectsInPhase(dependencyDir, phase);
+    prescanDependencies(mods, dependencyDir, phase, pool);
+    auto graph = DependencyGraph::build(mods, dependencyDir, phase);
+    for (DependencyGraph::NodeId id = 0; id < graph.size(); id++) {
+      if (!graph.missing(id) && graph.path(id).parent_path() == libs_dir) {
+        reachable.emplace(graph.path(id).filename().string());
+      }
+    }
+  }
+  std::unordered_set<std::string> unreachable{};
+  for (auto& lib : listAllObjectsInPhase(dependencyDir, LoadPhase::Libs)) {
+    auto name = lib.path.filename().string();
+    if (!reachable.contains(name)) {
+      unreachable.emplace(std::move(name));
+    }
+  }
+  return unreachable;
+}
+
+std::vector<SharedObject> listAllObjectsInPhase(std::filesystem::path const& dependencyDir, LoadPhase phase) {
+  std::vector<SharedObject> objects{};
+  auto index = get_directory_index(dependencyDir);
+  for (auto const* file : index->list(phase)) {
+    LOG_DEBUG("Walking over file: {}", file->path.c_str());
+    // All SharedObjects must be valid lib*.so files
+    if (file->directory) {
+      continue;
+    }
+    if (file->path.extension() != ".so") {
+      continue;
+    }
+    if (!file->path.filename().string().starts_with("lib")) {
       continue;
     }
 
-    std::vector<SharedObject> objects{};
+    LOG_DEBUG("Adding to attempt load: {}", file->path.c_str());
+    objects.emplace_back(file->path);
+  }
 
-    auto dir = dependencyDir / path;
-    std::filesystem::directory_iterator dir_iter(dir, error_code);
-    if (error_code) {
-      LOG_ERROR("Failed to find objects in phase: {} from: {}: {}", phase, dependencyDir.c_str(),
-                error_code.message().c_str());
-      return {};
-    }
-    for (auto const& file : dir_iter) {
-      if (error_code) {
-        LOG_WARN("Failed to open file while iterating: {}", dir.c_str());
-        continue;
-      }
-      // TODO: Add statcheck here
-      LOG_DEBUG("Walking over file: {}", file.path().c_str());
-      // All SharedObjects must be valid lib*.so files
-      if (file.is_directory()) {
-        continue;
-      }
-      if (file.path().extension() != ".so") {
-        continue;
-      }
-      if (!file.path().filename().string().starts_with("lib")) {
-        continue;
-      }
+  std::sort(objects.begin(), objects.end(),
+            [](SharedObject const& a, SharedObject const& b) constexpr { return a.path < b.path; });
+  // Objects are opened in listing order, so higher priorities go first
+  std::stable_sort(objects.begin(), objects.end(), [](SharedObject const& a, SharedObject const& b) {
+    return policy_of(a.path).priority > policy_of(b.path).priority;
+  });
 
-      LOG_DEBUG("Adding to attempt load: {}", file.path().c_str());
-      objects.emplace_back(file.path());
-    }
+  return objects;
+}
+
+bool isDeferred(std::filesystem::path const& path) noexcept {
+  auto const& deferred = get_config().deferredMods;
+  return policy_of(path).deferred ||
+         std::find(deferred.begin(), deferred.end(), path.filename().native()) != deferred.end();
+}
 
-    std::sort(objects.begin(), objects.end(),
-              [](SharedObject const& a, SharedObject const& b) constexpr { return a.path < b.path; });
+namespace {
 
-    return objects;
+bool equalsIgnoringCase(std::string_view a, std::string_view b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](unsigned char x, unsigned char y) {
+    return std::tolower(x) == std::tolower(y);
+  });
+}
+
+}  // namespace
+
+bool namesObject(std::string_view name, std::filesystem::path const& path, bool byId) noexcept {
+  auto const filename = path.filename();
+  if (name == filename.native()) {
+    return true;
   }
-  return {};
+  if (!byId) {
+    return false;
+  }
+  std::string_view stem = filename.native();
+  stem.remove_prefix(stem.starts_with("lib") ? 3 : 0);
+  stem.remove_suffix(stem.ends_with(".so") ? 3 : 0);
+  return equalsIgnoringCase(name, stem);
+}
+
+std::vector<SharedObject> listDeferredMods(std::filesystem::path const& dependencyDir) {
+  auto mods = listAllObjectsInPhase(dependencyDir, LoadPhase::Mods);
+  std::erase_if(mods, [](SharedObject const& mod) { return !isDeferred(mod.path); });
+  return mods;
+}
+
+/// @brief dlopens the staged object at path. Objects staged into a memfd are handed to the linker as the memfd itself,
+/// since a linker namespace only lets /proc/self/fd paths through if their target is on a permitted path, while a
+/// library fd on tmpfs is exempt from that check. The linux tests have no android_dlopen_ext, and go through
+/// /proc/self/fd.
+void* dlopenStaged(std::filesystem::path const& path, int flags) {
+#ifndef LINUX_TEST
+  if (auto const* memfd = staging::find_memfd(path)) {
+    android_dlextinfo extinfo{};
+    extinfo.flags = ANDROID_DLEXT_USE_LIBRARY_FD;
+    extinfo.library_fd = memfd->fd;
+    return android_dlopen_ext(path.c_str(), flags, &extinfo);
+  }
+#endif
+  return dlopen(staging::open_path(path).c_str(), flags);
 }
 
 // handle or failure message
 using OpenLibraryResult = std::variant<void*, std::string>;
 
-OpenLibraryResult openLibrary(std::filesystem::path const& path) {
-  LOG_DEBUG("Attempting to dlopen: {}", path.c_str());
+OpenLibraryResult openLibrary(std::filesystem::path const& path, LoadPolicy const& policy) {
+  LOG_DEBUG("Attempting to dlopen: {}{}", path.c_str(), policy.lazyBinding ? " lazily" : "");
   dlerror();  // consume possible previous error
   // TODO: Figure out why symbols are leaking!
-  auto* handle = dlopen(path.c_str(), RTLD_LOCAL | RTLD_NOW);
+  auto* handle = dlopenStaged(path, RTLD_LOCAL | (policy.lazyBinding ? RTLD_LAZY : RTLD_NOW));
   auto* error = dlerror();
   if (handle == nullptr || error != nullptr) {
     // Error logging (for if symbols cannot be resolved)
@@ -368,6 +447,15 @@ std::optional<T> getFunction(void* handle, std::string_view name, std::filesyste
   Dl_info info;
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
   if (dladdr(reinterpret_cast<void* const>(ptr), &info)) {
+    if (auto const* memfd = staging::find_memfd(path)) {
+      // Objects opened from a memfd are reported under the memfd's name instead
+      if (memfd->realpath != info.dli_fname) {
+        LOG_WARN("The function {} {} is from {} but should be from {}!", name.data(), fmt::ptr(ptr), info.dli_fname,
+                 memfd->realpath.c_str());
+        return std::nullopt;
+      }
+      return ptr;
+    }
     auto expectedObjName = path.filename();
     auto expectedObjParent = path.parent_path().filename();
     auto addrObjPath = std::filesystem::path(info.dli_fname);
@@ -386,54 +474,248 @@ std::optional<T> getFunction(void* handle, std::string_view name, std::filesyste
   return ptr;
 }
 
-std::vector<LoadResult> loadMod(SharedObject&& mod, std::filesystem::path const& dependencyDir,
-                                std::unordered_set<std::string>& skipLoad, LoadPhase phase) {
-  if (skipLoad.contains(mod.path)) {
-    LOG_WARN("Already loaded object at path: {}", mod.path.c_str());
-    return {};
-  }
+namespace {
 
-  auto handleResult = [phase](OpenLibraryResult&& result, SharedObject&& obj,
-                              std::vector<DependencyResult>&& dependencies) -> LoadResult {
-    if (auto const* error = get_if<std::string>(&result)) {
-      return FailedMod(std::move(obj), *error, std::move(dependencies));
+/// @brief The address the object of handle was loaded at, found from a lifecycle function its scan located. dlsym on a
+/// handle looks in the object itself first, and the base is that of the object whose segments hold what it returns, so
+/// it only counts if the function sits at the scanned value from that base.
+std::optional<uintptr_t> loadBase(void* handle, elf_metadata::Lifecycle const& lifecycle) {
+  using elf_metadata::Export;
+  struct Search {
+    uintptr_t address;
+    std::optional<uintptr_t> base;
+  };
+  for (auto [value, name] : { std::pair{ Export::kSetup, "setup" }, std::pair{ Export::kLoad, "load" },
+                              std::pair{ Export::kLateLoad, "late_load" }, std::pair{ Export::kUnload, "unload" } }) {
+    auto offset = lifecycle.valueOf(value);
+    if (!lifecycle.exported(value) || offset == 0) {
+      continue;
     }
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto address = reinterpret_cast<uintptr_t>(dlsym(handle, name));
+    // Consume any error, a function that cannot be found is simply not used
+    dlerror();
+    if (address == 0) {
+      continue;
+    }
+    Search search{ .address = address, .base = std::nullopt };
+    dl_iterate_phdr(
+        [](dl_phdr_info* info, size_t, void* data) {
+          auto* search = static_cast<Search*>(data);
+          for (size_t i = 0; i < info->dlpi_phnum; i++) {
+            auto const& phdr = info->dlpi_phdr[i];
+            auto start = static_cast<uintptr_t>(info->dlpi_addr + phdr.p_vaddr);
+            if (phdr.p_type == PT_LOAD && search->address >= start && search->address - start < phdr.p_memsz) {
+              search->base = static_cast<uintptr_t>(info->dlpi_addr);
+              return 1;
+            }
+          }
+          return 0;
+        },
+        &search);
+    if (search.base && search.address - *search.base == offset) {
+      return search.base;
+    }
+    LOG_WARN("The function {} at: 0x{:x} is not at its scanned offset: 0x{:x}, not locating functions from the scan",
+             name, search.address, offset);
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
 
-    auto* handle = get<void*>(result);
+/// @brief Locates the lifecycle function value of an opened object from its scan, which only records functions the
+/// object defines itself, so nothing interposed from another object is ever picked up. Falls back to dlsym when the
+/// scan could not locate it.
+/// @param base The load base of the object, nullopt if it is unknown
+template <typename T>
+std::optional<T> lifecycleFunction(ScannedObject const* scanned, std::optional<uintptr_t> base,
+                                   elf_metadata::Export value, void* handle, std::string_view name,
+                                   std::filesystem::path const& path) {
+  if (scanned == nullptr || !scanned->readable) {
+    return getFunction<T>(handle, name, path);
+  }
+  if (!scanned->lifecycle.exported(value)) {
+    return std::nullopt;
+  }
+  auto offset = scanned->lifecycle.valueOf(value);
+  if (!base || offset == 0) {
+    return getFunction<T>(handle, name, path);
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast,performance-no-int-to-ptr)
+  auto ptr = reinterpret_cast<T>(*base + offset);
+  LOG_DEBUG("Located function with name: {}, addr: {} from the scan of: {}", name.data(), fmt::ptr(ptr),
+            path.c_str());
+  return ptr;
+}
 
-    LOG_INFO("Using handle {} for {}", handle, obj.path.c_str());
+/// @brief Interned paths of every object that failed to open during this launch, including known failures.
+/// Like skipLoad, only touched while opening objects, which the modloader serializes with its registry lock.
+IdSet& failedObjects() {
+  static IdSet failed{};
+  return failed;
+}
 
-    // Default modinfo is full path and v0.0.0, 0
-    // The lifetime of the fullpath's c_str() is longer than this ModInfo, since this SharedObject will live forever
-    ModInfo modInfo(obj.path.c_str(), "0.0.0", 0);
+LoadResult handleResult(OpenLibraryResult&& result, SharedObject&& obj, LoadPhase phase, DependencyGraph const& graph,
+                        DependencyGraph::NodeId id) {
+  if (auto const* error = get_if<std::string>(&result)) {
+    failedObjects().insert(graph.pathId(id));
+    // Only failures keep a tree of their dependencies around, for reporting
+    return FailedMod(std::move(obj), *error, graph.nodesOf(id));
+  }
 
-    auto setupFn = getFunction<SetupFunc>(handle, "setup", obj.path);
-    auto loadFn = getFunction<LoadFunc>(handle, "load", obj.path);
-    auto late_loadFn = getFunction<LateLoadFunc>(handle, "late_load", obj.path);
-    auto unloadFn = getFunction<UnloadFunc>(handle, "unload", obj.path);
+  auto* handle = get<void*>(result);
 
-    return LoadedMod(modInfo, std::move(obj), phase, setupFn, loadFn, late_loadFn, unloadFn, handle);
-  };
+  LOG_INFO("Using handle {} for {}", handle, obj.path.c_str());
 
-  auto deps = mod.getToLoad(dependencyDir, phase);
-  LOG_DEBUG("Fetched dependencies");
-  // Sorted is a COPY of deps
-  auto sorted = topologicalSort(static_cast<std::span<DependencyResult const>>(deps));
-  LOG_DEBUG("Sorted dependencies");
+  // Default modinfo is full path and v0.0.0, 0
+  // The lifetime of the fullpath's c_str() is longer than this ModInfo, since this SharedObject will live forever
+  ModInfo modInfo(obj.path.c_str(), "0.0.0", 0);
 
-  std::vector<LoadResult> results{};
-  results.reserve(sorted.size());
+  // Plain libs define none of the functions, so they never pay for finding their base
+  auto const* scanned = graph.scanned(id);
+  std::optional<uintptr_t> base{};
+  if (scanned != nullptr && scanned->lifecycle.exports != 0) {
+    base = loadBase(handle, scanned->lifecycle);
+  }
+  using elf_metadata::Export;
+  auto setupFn = lifecycleFunction<SetupFunc>(scanned, base, Export::kSetup, handle, "setup", obj.path);
+  auto loadFn = lifecycleFunction<LoadFunc>(scanned, base, Export::kLoad, handle, "load", obj.path);
+  auto late_loadFn = lifecycleFunction<LateLoadFunc>(scanned, base, Export::kLateLoad, handle, "late_load", obj.path);
+  auto unloadFn = lifecycleFunction<UnloadFunc>(scanned, base, Export::kUnload, handle, "unload", obj.path);
+
+  return LoadedMod(modInfo, std::move(obj), phase, setupFn, loadFn, late_loadFn, unloadFn, handle);
+}
+
+void logCycles(DependencyGraph const& graph, std::span<std::vector<DependencyGraph::NodeId> const> cycles) {
+  std::vector<DependencyCycle> described(cycles.size());
+  for (size_t i = 0; i < cycles.size(); i++) {
+    for (auto node : cycles[i]) {
+      described[i].objects.push_back(graph.path(node));
+    }
+  }
+  logCycles(described);
+}
+
+/// @brief What opening a node consults besides the graph, each of which may be left out
+struct OpenHooks {
+  // Checks required symbols before each object is opened
+  SymbolChecker* checker = nullptr;
+  // Is told which object is being opened, to read ahead of it
+  Prefetcher* prefetcher = nullptr;
+};
+
+/// @brief The key a failure of id is recorded under: the object, everything it transitively depends on, and the
+/// dependencies that could not be resolved
+/// @return The key, or nullopt if one of the objects cannot be identified across launches
+std::optional<uint64_t> failureKey(DependencyGraph const& graph, DependencyGraph::NodeId id) {
+  failure_cache::KeyBuilder key;
+  auto order = graph.loadOrder(id);
+  order.push_back(id);
+  for (auto node : order) {
+    if (!key.add(graph.path(node))) {
+      return std::nullopt;
+    }
+    for (auto dep : graph.dependencies(node)) {
+      if (graph.missing(dep)) {
+        key.addMissing(graph.path(dep).native());
+      }
+    }
+  }
+  return key.finish();
+}
+
+/// @brief The failure id opened with in an earlier launch, if nothing it was opened against has changed since
+std::optional<std::string> knownFailure(DependencyGraph const& graph, DependencyGraph::NodeId id) {
+  // Only objects that failed before pay for building their key
+  if (!get_config().failureCache || !failure_cache::contains(graph.path(id))) {
+    return std::nullopt;
+  }
+  auto key = failureKey(graph, id);
+  if (!key) {
+    return std::nullopt;
+  }
+  auto failure = failure_cache::find(graph.path(id), *key);
+  if (failure) {
+    LOG_INFO("Not opening: {}, it failed with: {} and nothing it depends on changed since", graph.path(id).c_str(),
+             failure->c_str());
+  }
+  return failure;
+}
+
+/// @brief Opens the object of id, unless the checker finds symbols it requires that nothing defines
+OpenLibraryResult openChecked(DependencyGraph const& graph, DependencyGraph::NodeId id, OpenHooks const& hooks) {
+  auto policy = policy_of(graph.path(id));
+  // Lazily bound objects only need their functions once they are called, so missing ones do not fail the open
+  if (hooks.checker != nullptr && !policy.lazyBinding) {
+    auto missing = hooks.checker->missingSymbols(graph, id);
+    if (missing && !missing->empty()) {
+      std::string failure = "not opened, no dependency defines required symbols:";
+      for (auto const& symbol : *missing) {
+        failure += ' ';
+        failure += symbol;
+      }
+      return failure;
+    }
+  }
+  return openLibrary(graph.path(id), policy);
+}
 
-  for (auto&& dep : sorted) {
-    if (skipLoad.contains(dep.object.path)) {
+/// @brief Whether everything id depends on was opened during this launch, rather than failing or not being tried
+bool dependenciesOpened(DependencyGraph const& graph, DependencyGraph::NodeId id, IdSet const& skipLoad) {
+  auto const& failed = failedObjects();
+  return std::ranges::all_of(graph.loadOrder(id), [&](DependencyGraph::NodeId dep) {
+    return skipLoad.contains(graph.pathId(dep)) && !failed.contains(graph.pathId(dep));
+  });
+}
+
+/// @brief Opens the object of id, unless it is known to fail, and records whether it failed
+OpenLibraryResult openNode(DependencyGraph const& graph, DependencyGraph::NodeId id, IdSet const& skipLoad,
+                           OpenHooks const& hooks) {
+  if (hooks.prefetcher != nullptr) {
+    hooks.prefetcher->opening(id);
+  }
+  if (auto failure = knownFailure(graph, id)) {
+    return std::move(*failure);
+  }
+  auto const& path = graph.path(id);
+  if (!staging::verify_staged(path)) {
+    // The mismatched copy was removed, nothing may find it through an index anymore. The next launch stages it again,
+    // so this says nothing about whether the object itself opens and is never recorded.
+    invalidate_directory_index_of(path);
+    return std::string("staged object changed after its content was hashed");
+  }
+  auto result = openChecked(graph, id, hooks);
+  if (!get_config().failureCache) {
+    return result;
+  }
+  if (auto const* failure = get_if<std::string>(&result)) {
+    // A failure that follows from a dependency that did not open is not the object's own
+    if (!dependenciesOpened(graph, id, skipLoad)) {
+      return result;
+    }
+    if (auto key = failureKey(graph, id)) {
+      failure_cache::record(path, *key, *failure);
+    }
+  } else {
+    failure_cache::forget(path);
+  }
+  return result;
+}
+
+/// @brief Opens dependencies in the order provided, then mod itself
+/// @param id The node of mod in graph
+void loadGroup(SharedObject&& mod, DependencyGraph const& graph, DependencyGraph::NodeId id,
+               std::span<DependencyGraph::NodeId const> dependencies, IdSet& skipLoad, LoadPhase phase,
+               OpenHooks const& hooks, std::vector<LoadResult>& results) {
+  for (auto dep : dependencies) {
+    auto const& depPath = graph.path(dep);
+    if (!skipLoad.insert(graph.pathId(dep))) {
       continue;
     }
 
-    auto result = openLibrary(dep.object.path);
-    skipLoad.emplace(dep.object.path);
-    // The moves here are correct, because we are moving from the copied sorted collection
+    auto result = openNode(graph, dep, skipLoad, hooks);
     auto const& handled =
-        results.emplace_back(handleResult(std::move(result), std::move(dep.object), std::move(dep.dependencies)));
+        results.emplace_back(handleResult(std::move(result), SharedObject(depPath), phase, graph, dep));
 
     if (auto const* failed = get_if<FailedMod>(&handled)) {
       // If we fail to open a dependency of the mod we are trying to open, we continue anyways, hoping that we will be
@@ -443,32 +725,162 @@ std::vector<LoadResult> loadMod(SharedObject&& mod, std::filesystem::path const&
     }
   }
 
-  auto result = openLibrary(mod.path);
-  skipLoad.emplace(mod.path);
+  auto result = openNode(graph, id, skipLoad, hooks);
+  skipLoad.insert(graph.pathId(id));
 
   LOG_DEBUG("Loaded mod from path: {} with: {} (1 indicates failure that will be logged later)", mod.path.c_str(),
             result.index());
-  results.emplace_back(handleResult(std::move(result), std::move(mod), std::move(deps)));
+  results.emplace_back(handleResult(std::move(result), std::move(mod), phase, graph, id));
+}
+
+}  // namespace
+
+std::vector<LoadResult> loadMod(SharedObject&& mod, std::filesystem::path const& dependencyDir,
+                                IdSet& skipLoad, LoadPhase phase) {
+  if (skipLoad.contains(intern_path(mod.path))) {
+    LOG_WARN("Already loaded object at path: {}", mod.path.c_str());
+    return {};
+  }
+
+  auto graph = DependencyGraph::build(std::span<SharedObject const>(&mod, 1), dependencyDir, phase);
+  LOG_DEBUG("Fetched dependencies");
+  std::vector<std::vector<DependencyGraph::NodeId>> cycles{};
+  auto sorted = graph.loadOrder(0, &cycles);
+  LOG_DEBUG("Sorted dependencies");
+  logCycles(graph, cycles);
+
+  std::vector<LoadResult> results{};
+  results.reserve(sorted.size() + 1);
+  SymbolChecker checker{};
+  OpenHooks hooks{ .checker = get_config().verifySymbols ? &checker : nullptr, .prefetcher = nullptr };
+  loadGroup(std::move(mod), graph, 0, sorted, skipLoad, phase, hooks, results);
   return results;
 }
 
-// mods is an OWNING span of SharedObjects! They will be moved FROM mods into results
-std::vector<LoadResult> loadMods(std::span<SharedObject> mods, std::filesystem::path const& dependencyDir,
-                                 std::unordered_set<std::string>& skipLoad, LoadPhase phase) {
+PhasePlan planPhase(std::span<SharedObject const> mods, std::filesystem::path const& dependencyDir, LoadPhase phase,
+                    ThreadPool& pool) {
+  // Read every object the phase depends on in parallel, so the graph below is built from memory
+  prescanDependencies(mods, dependencyDir, phase, pool);
+  auto arena = std::make_unique<PhaseArena>();
+  auto graph = DependencyGraph::build(mods, dependencyDir, phase, arena->resource());
+  auto order = graph.plan();
+  logCycles(graph, order.cycles);
+  LOG_DEBUG("Planned phase: {} with: {} roots opening: {} dependencies, using: {} allocations ({} bytes) of its arena",
+            phase, order.groups.size(), order.steps.size(), arena->allocations(), arena->bytes());
+  return PhasePlan{ .arena = std::move(arena), .phase = phase, .graph = std::move(graph), .order = std::move(order) };
+}
+
+std::deque<PhasePlan> planPhases(std::filesystem::path const& dependencyDir) {
+  auto start = std::chrono::steady_clock::now();
+  std::deque<PhasePlan> plans{};
+  // Objects shared between phases are only scanned by the first phase that reaches them
+  auto& pool = ThreadPool::shared();
+  for (auto phase : { LoadPhase::Libs, LoadPhase::EarlyMods, LoadPhase::Mods }) {
+    auto objects = listAllObjectsInPhase(dependencyDir, phase);
+    if (phase == LoadPhase::Mods) {
+      // Deferred mods are left out of the plan, but scanned now so that one required while the phases are opened reads
+      // nothing
+      auto deferred = std::stable_partition(objects.begin(), objects.end(),
+                                            [](SharedObject const& mod) { return !isDeferred(mod.path); });
+      auto planned = static_cast<size_t>(deferred - objects.begin());
+      prescanDependencies(std::span<SharedObject const>(objects).subspan(planned), dependencyDir, phase, pool);
+      objects.erase(deferred, objects.end());
+    }
+    plans.push_back(planPhase(objects, dependencyDir, phase, pool));
+  }
+  LOG_INFO("Planned all phases in {}us",
+           std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+  return plans;
+}
+
+std::vector<LoadResult> executePlan(PhasePlan const& plan, IdSet& skipLoad) {
+  auto const& graph = plan.graph;
   std::vector<LoadResult> results;
-  results.reserve(mods.size());
+  results.reserve(plan.order.groups.size() + plan.order.steps.size());
+
+  // Groups only hold what earlier groups did not, which assumes every earlier group was opened. A skipped group marks
+  // its root and the dependencies it left unopened, and only a group that directly depends on a marked object walks its
+  // full load order instead. Anything reaching a marked object otherwise does so through such a group.
+  enum struct Skipped : uint8_t {
+    None,
+    // A dependency of a skipped group, stale until something opens it
+    Step,
+    // A skipped root, its own dependencies may still be unopened
+    Root,
+  };
+  std::pmr::vector<Skipped> skipped(graph.size(), Skipped::None, graph.resource());
+  auto skipGroup = [&](DependencyGraph::Plan::Group const& group) {
+    skipped[group.root] = Skipped::Root;
+    for (auto dep : plan.order.dependencies(group)) {
+      if (!skipLoad.contains(graph.pathId(dep))) {
+        skipped[dep] = Skipped::Step;
+      }
+    }
+  };
+  auto dependsOnSkipped = [&](DependencyGraph::Plan::Group const& group) {
+    auto stale = [&](DependencyGraph::NodeId node) {
+      return std::ranges::any_of(graph.dependencies(node), [&](DependencyGraph::NodeId dep) {
+        return skipped[dep] == Skipped::Root ||
+               (skipped[dep] == Skipped::Step && !skipLoad.contains(graph.pathId(dep)));
+      });
+    };
+    return stale(group.root) || std::ranges::any_of(plan.order.dependencies(group), stale);
+  };
+  SymbolChecker checker{};
+  OpenHooks hooks{ .checker = get_config().verifySymbols ? &checker : nullptr, .prefetcher = nullptr };
+  // Reads ahead in the order the plan opens objects in, which is each group's dependencies followed by its root
+  std::optional<Prefetcher> prefetcher{};
+  if (auto budget = get_config().prefetchBudget; budget != 0 && !plan.order.groups.empty()) {
+    std::pmr::vector<DependencyGraph::NodeId> order(graph.resource());
+    order.reserve(plan.order.steps.size() + plan.order.groups.size());
+    for (auto const& group : plan.order.groups) {
+      for (auto dep : plan.order.dependencies(group)) {
+        // Opened by an earlier phase, so it is in memory already
+        if (!skipLoad.contains(graph.pathId(dep))) {
+          order.push_back(dep);
+        }
+      }
+      order.push_back(group.root);
+    }
+    hooks.prefetcher = &prefetcher.emplace(graph, order, budget);
+  }
+  for (auto const& group : plan.order.groups) {
+    auto const& path = graph.path(group.root);
+    if (skipLoad.contains(graph.pathId(group.root))) {
+      skipGroup(group);
+      continue;
+    }
 
-  for (auto&& mod : mods) {
-    if (skipLoad.contains(mod.path)) {
+    if (auto failure = knownFailure(graph, group.root)) {
+      // None of its dependencies are opened for it either, the groups after it open the ones they need themselves
+      skipLoad.insert(graph.pathId(group.root));
+      results.emplace_back(
+          handleResult(OpenLibraryResult(std::move(*failure)), SharedObject(path), plan.phase, graph, group.root));
+      skipGroup(group);
       continue;
     }
 
-    LOG_DEBUG("Attempting to dlopen and setup (moved) mod: {}", mod.path.c_str());
-    auto otherResults = loadMod(std::move(mod), dependencyDir, skipLoad, phase);
-    LOG_DEBUG("After opening mod, now have: {} opened libraries", otherResults.size());
-    std::move(otherResults.begin(), otherResults.end(), std::back_inserter(results));
+    LOG_DEBUG("Attempting to dlopen and setup mod: {}", path.c_str());
+    auto before = results.size();
+    if (dependsOnSkipped(group)) {
+      auto sorted = graph.loadOrder(group.root);
+      loadGroup(SharedObject(path), graph, group.root, sorted, skipLoad, plan.phase, hooks, results);
+    } else {
+      loadGroup(SharedObject(path), graph, group.root, plan.order.dependencies(group), skipLoad, plan.phase, hooks,
+                results);
+    }
+    LOG_DEBUG("After opening mod, now have: {} opened libraries", results.size() - before);
   }
 
+  LOG_INFO("Phase: {} made: {} allocations ({} bytes) from its arena, taking: {} blocks from the heap", plan.phase,
+           plan.arena->allocations(), plan.arena->bytes(), plan.arena->heapAllocations());
   return results;
 }
+
+// Plans and opens a single phase, mods are left as they are
+std::vector<LoadResult> loadMods(std::span<SharedObject> mods, std::filesystem::path const& dependencyDir,
+                                 IdSet& skipLoad, LoadPhase phase) {
+  auto plan = planPhase(mods, dependencyDir, phase, ThreadPool::shared());
+  return executePlan(plan, skipLoad);
+}
 }  // namespace modloader
@@ -15,6 +15,7 @@
 #include "protect.hpp"
 
 #include "capstone-utils.hpp"
+#include "config.hpp"
 #include "elf-utils.hpp"
 #include "runtime-restriction.hpp"
 #include "trampoline-allocator.hpp"
@@ -343,6 +344,7 @@ MODLOADER_FUNC void modloader_preload(JNIEnv* env, char const* appId, char const
   if (env->GetJavaVM(&modloader_jvm) != 0) {
     LOG_WARN("Failed to get JavaVM! Be careful when using it!");
   }
+  modloader::get_config() = modloader::LoaderConfig::read(modloader_root_load_path / modloader::kConfigName);
   if (!modloader::copy_all(files_dir)) {
     LOG_FATAL("Failed to copy over files! Modloading cannot continue!");
     failed = true;
@@ -1,5 +1,9 @@
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <new>
 #include <optional>
 #include <variant>
@@ -7,13 +11,25 @@
 #ifndef LINUX_TEST
 #include <jni.h>
 #include <sys/stat.h>
+#ifdef ANDROID
+#include <sys/system_properties.h>
+#endif
 #include <filesystem>
 #include <system_error>
 #include "_config.h"
+#include "config.hpp"
+#include "dependency-graph.hpp"
+#include "directory-index.hpp"
+#include "elf-image.hpp"
+#include "elf-metadata.hpp"
+#include "failure-cache.hpp"
 #include "internal-loader.hpp"
 #include "loader.hpp"
 #include "log.h"
 #include "modloader.h"
+#include "lifecycle-scheduler.hpp"
+#include "staging.hpp"
+#include "thread-pool.hpp"
 
 MODLOADER_EXPORT JavaVM* modloader_jvm;
 MODLOADER_EXPORT void* modloader_libil2cpp_handle;
@@ -34,7 +50,22 @@ std::vector<modloader::LoadResult> loaded_early_mods;
 // Private set for mods
 std::vector<modloader::LoadResult> loaded_mods;
 // Private set to avoid dlopening redundantly
-std::unordered_set<std::string> skip_load{};
+modloader::IdSet skip_load{};
+// Plans of the phases that have not been opened yet, in phase order, all made when the first phase is opened
+std::deque<modloader::PhasePlan> pending_plans{};
+// Deferred mods that have not been opened yet
+std::vector<modloader::SharedObject> deferred_mods;
+// The root every phase is opened from
+std::filesystem::path load_root;
+// Deferred mods that have been opened, along with their dependencies. A deque, so that results stay where they are
+// while the setup of one deferred mod opens another.
+std::deque<modloader::LoadResult> loaded_deferred_mods;
+// Whether late_load has been called on the mods, so that deferred mods opened afterwards get it right away
+bool mods_late_loaded = false;
+// Guards the results, skip_load, pending_plans and deferred mods above, since a deferred mod may be opened from any
+// thread that requires it. Recursive, because constructors run by dlopen may look up mods themselves. Never held
+// while setup or late_load are called, which may wait for threads that need it.
+std::recursive_mutex registry_mutex;
 
 // Get status type as string
 char const* status_type(std::filesystem::file_type const type) {
@@ -109,43 +140,69 @@ void ensure_dir_exists(std::filesystem::path const& dir) {
   }
 }
 
-bool remove_dir(std::filesystem::path const& dir) {
-  // First, statdump
-  statdump(dir);
-  // Next, try to recursively remove it
-  std::error_code err{};
-  std::filesystem::remove_all(dir, err);
-  if (err) {
-    LOG_ERROR("Failed to remove directory: {}", dir.c_str());
-    return false;
-  }
-  return true;
-}
-
 }  // namespace
 
 namespace modloader {
 
 bool copy_all(std::filesystem::path const& filesDir) noexcept {
   auto const& base_path = get_modloader_root_load_path();
+  elf_metadata::load(filesDir / elf_metadata::kCacheName);
+  auto& pool = ThreadPool::shared();
+  // Resolved against the source tree, before anything is staged
+  staging::Exclusions unreachable_libs{};
+  if (get_config().pruneLibs) {
+    unreachable_libs = findUnreachableLibs(base_path);
+    // Those scans were of the source tree, nothing is ever planned against it
+    clearScanned();
+    for (auto const& lib : unreachable_libs) {
+      LOG_INFO("Not staging lib: {}, no early mod or mod depends on it", lib.c_str());
+    }
+  }
+  auto excluded_in = [&](LoadPhase phase) -> staging::Exclusions const& {
+    static staging::Exclusions const none{};
+    return phase == LoadPhase::Libs ? unreachable_libs : none;
+  };
+  if (get_config().memfdStaging) {
+    // Objects only ever live in memory, there is nothing in the files dir to keep track of
+    for (auto const& [phase, path] : loadPhaseMap.arr) {
+      auto src = base_path / path;
+      ensure_dir_exists(src);
+      staging::PhaseStats stats{};
+      if (!staging::stage_phase_memfd(src, filesDir / path, pool, stats, excluded_in(phase))) {
+        LOG_ERROR("Failed during phase: {} to stage directory: {} into memfds", phase, src.c_str());
+        return false;
+      }
+      LOG_INFO("Staged phase: {} with {} workers: {} into memfds ({} bytes) in {}us", phase, pool.size(), stats.memfd,
+               stats.bytes, std::chrono::duration_cast<std::chrono::microseconds>(stats.elapsed).count());
+    }
+    invalidate_directory_indices();
+    return true;
+  }
+
+  auto manifest_path = filesDir / staging::kManifestName;
+  auto manifest = staging::Manifest::read(manifest_path);
   std::error_code error_code;
   for (auto const& [phase, path] : loadPhaseMap.arr) {
     auto dst = filesDir / path;
     auto src = base_path / path;
     ensure_dir_exists(src);
-    if (!remove_dir(dst)) {
-      LOG_ERROR("Failed to remove dst directory, stopping loading process early to avoid grabbing old mods...");
-      return false;
-    }
     ensure_dir_exists(dst);
-    std::filesystem::copy(src, dst,
-                          std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing,
-                          error_code);
-    if (error_code) {
-      LOG_ERROR("Failed during phase: {} to copy directory: {} to: {}: {}", phase, src.c_str(), dst.c_str(),
-                error_code.message().c_str());
+    // Only copy what changed since the last time we staged, the manifest tracks what is already in dst
+    auto& records = manifest.phases[std::string(path)];
+    staging::PhaseStats stats{};
+    if (!staging::stage_phase(src, dst, records, pool, stats, excluded_in(phase))) {
+      LOG_ERROR("Failed during phase: {} to stage directory: {} to: {}", phase, src.c_str(), dst.c_str());
+      // Persist what we did manage to stage, so that the next attempt does not redo it
+      static_cast<void>(manifest.write(manifest_path));
       return false;
     }
+    // Copies have the bytes of their source, so whatever was read from a source while pruning libs is not read again
+    for (auto const& [relative, record] : records.files) {
+      elf_metadata::reuse(src / relative, dst / relative, record);
+    }
+    LOG_INFO("Staged phase: {} with {} workers: {} reflinked, {} copied ({} bytes), {} removed, {} unchanged in {}us",
+             phase, pool.size(), stats.reflinked, stats.copied, stats.bytes, stats.removed, stats.unchanged,
+             std::chrono::duration_cast<std::chrono::microseconds>(stats.elapsed).count());
     std::filesystem::permissions(dst, std::filesystem::perms::all, error_code);
     if (error_code) {
       LOG_ERROR("Failed during phase: {} to set permissions on copied directory: {}: {}", phase, dst.c_str(),
@@ -153,17 +210,199 @@ bool copy_all(std::filesystem::path const& filesDir) noexcept {
       return false;
     }
   }
+  if (!manifest.write(manifest_path)) {
+    LOG_WARN("Failed to write staging manifest, the next launch will stage everything again");
+  }
+  // Anything indexed so far describes the files dir from before staging
+  invalidate_directory_indices();
   return true;
 }
 
+namespace {
+
+/// @brief The key of what objects are opened against besides what they depend on: the game, the OS, the modloader,
+/// the config that decides how objects are opened, and every file in the phase directories. Any object can change
+/// whether another one opens, by what it adds to the global group or does while it is opened, and policy files change
+/// how objects are opened. So any change to them drops every recorded failure.
+/// @return The key, or nullopt if a staged file cannot be identified across launches
+std::optional<uint64_t> environment_key(std::filesystem::path const& filesDir) {
+  failure_cache::KeyBuilder key;
+  for (auto const& path : { get_libil2cpp_path(), get_modloader_source_path() }) {
+    if (!key.add(path)) {
+      key.addMissing(path.native());
+    }
+  }
+#ifdef ANDROID
+  // Changes with every update of the system libraries
+  std::array<char, PROP_VALUE_MAX> fingerprint{};
+  __system_property_get("ro.build.fingerprint", fingerprint.data());
+  key.addValue(fingerprint.data());
+#endif
+  auto const& config = get_config();
+  key.addValue(config.verifySymbols ? "verify_symbols" : "");
+  key.addValue(config.memfdStaging ? "memfd_staging" : "");
+  auto index = get_directory_index(filesDir);
+  for (auto const& [phase, directory] : loadPhaseMap.arr) {
+    auto files = index->list(phase);
+    // Listed in directory order, which may differ between launches
+    std::sort(files.begin(), files.end(), [](auto const* a, auto const* b) { return a->path < b->path; });
+    for (auto const* file : files) {
+      if (!file->directory && !key.add(file->path)) {
+        LOG_INFO("Not using the failure cache, staged file: {} cannot be identified across launches",
+                 file->path.c_str());
+        return std::nullopt;
+      }
+    }
+  }
+  return key.finish();
+}
+
+/// @brief Opens phase from its pending plan, planning it on its own if it has none
+std::vector<LoadResult> open_phase(std::filesystem::path const& filesDir, LoadPhase phase) {
+  if (pending_plans.empty() || pending_plans.front().phase != phase) {
+    auto objects = listAllObjectsInPhase(filesDir, phase);
+    return loadMods(objects, filesDir, skip_load, phase);
+  }
+  LOG_DEBUG("Found: {} candidates! Attempting to load them...", pending_plans.front().order.groups.size());
+  auto results = executePlan(pending_plans.front(), skip_load);
+  // Releases the arena of the phase in one step
+  pending_plans.pop_front();
+  return results;
+}
+
+/// @brief Whether mod and every deferred mod that would be opened along with it are thread safe
+bool deferred_thread_safe(SharedObject const& mod) {
+  auto graph = DependencyGraph::build(std::span<SharedObject const>(&mod, 1), load_root, LoadPhase::Mods);
+  auto order = graph.loadOrder(0);
+  order.push_back(0);
+  return std::ranges::all_of(order, [&graph](DependencyGraph::NodeId id) {
+    auto const& path = graph.path(id);
+    bool deferred =
+        std::ranges::any_of(deferred_mods, [&path](SharedObject const& other) { return other.path == path; });
+    return !deferred || policy_of(path).threadSafe;
+  });
+}
+
+/// @brief Opens a deferred mod and everything it depends on, in load order, then calls setup on everything that was
+/// opened, and late_load too if the other mods have had it called already
+/// @param lock The held lock of registry_mutex, released before any setup is called
+/// @return The result of the mod itself, nullptr if it had been opened some other way already
+LoadResult* open_deferred_mod(std::unique_lock<std::recursive_mutex>& lock,
+                              std::vector<SharedObject>::iterator deferred) {
+  if (!late_mods_opened && current_load_phase != CLoadPhase::LoadPhase_Mods) {
+    LOG_WARN("Not opening deferred mod: {} before the mods phase", deferred->path.c_str());
+    return nullptr;
+  }
+  // Workers only make thread safe calls, and opening a mod runs its constructors on the thread that opens it
+  if (onLifecycleWorker() && !deferred_thread_safe(*deferred)) {
+    LOG_ERROR("Not opening deferred mod: {} from a worker, it or a deferred mod it depends on is not thread safe",
+              deferred->path.c_str());
+    return nullptr;
+  }
+  auto mod = std::move(*deferred);
+  deferred_mods.erase(deferred);
+  LOG_INFO("Opening deferred mod: {}", mod.path.c_str());
+  auto results = loadMod(std::move(mod), load_root, skip_load, LoadPhase::Mods);
+  // Deferred mods it depends on were opened along with it
+  std::erase_if(deferred_mods, [](SharedObject const& other) { return skip_load.contains(intern_path(other.path)); });
+  if (!failure_cache::save()) {
+    LOG_WARN("Failed to write failure cache");
+  }
+  if (results.empty()) {
+    return nullptr;
+  }
+  // Elements of a deque stay where they are as more are appended, so these stay valid without the lock
+  std::vector<LoadResult*> opened{};
+  opened.reserve(results.size());
+  for (auto& result : results) {
+    opened.push_back(&loaded_deferred_mods.emplace_back(std::move(result)));
+  }
+  auto late_load = mods_late_loaded;
+  lock.unlock();
+  // Setup may open more deferred mods, which are appended after these and set up by their own call
+  for (auto* result : opened) {
+    if (auto* loaded_mod = std::get_if<LoadedMod>(result)) {
+      if (!setupNow(*loaded_mod)) {
+        LOG_INFO("No setup on mod: {}", loaded_mod->object.path.c_str());
+      }
+      if (late_load && !lateLoadAfterDependencies(*loaded_mod)) {
+        LOG_INFO("No late_load function on mod: {}", loaded_mod->object.path.c_str());
+      }
+    } else if (auto* fail = std::get_if<FailedMod>(result)) {
+      LOG_WARN("Skipping setup call on: {} because it failed: {}", fail->object.path.c_str(), fail->failure.c_str());
+    }
+  }
+  // The mod itself is opened after everything it depends on
+  return opened.back();
+}
+
+/// @brief Opens the deferred mod that name refers to, see @ref namesObject
+/// @return The result of the mod, nullptr if no deferred mod is called name
+LoadResult* open_deferred_named(std::string_view name, bool by_id) {
+  std::unique_lock lock(registry_mutex);
+  auto found = std::find_if(deferred_mods.begin(), deferred_mods.end(),
+                            [&](SharedObject const& mod) { return namesObject(name, mod.path, by_id); });
+  return found == deferred_mods.end() ? nullptr : open_deferred_mod(lock, found);
+}
+
+/// @brief Finds the opened mod whose file is called name, opening it first if it is deferred
+std::optional<std::reference_wrapper<LoadedMod>> get_mod_by_object(std::string_view name) {
+  auto find_in = [name](auto& results) -> LoadedMod* {
+    for (auto& result : results) {
+      auto* loaded = std::get_if<LoadedMod>(&result);
+      if (loaded != nullptr && namesObject(name, loaded->object.path, false)) {
+        return loaded;
+      }
+    }
+    return nullptr;
+  };
+  LoadedMod* found = nullptr;
+  {
+    std::unique_lock lock(registry_mutex);
+    found = find_in(loaded_mods);
+    if (found == nullptr) {
+      found = find_in(loaded_early_mods);
+    }
+    if (found == nullptr) {
+      found = find_in(loaded_deferred_mods);
+    }
+  }
+  if (found == nullptr) {
+    found = std::get_if<LoadedMod>(open_deferred_named(name, false));
+  }
+  if (found == nullptr) {
+    return std::nullopt;
+  }
+  return std::ref(*found);
+}
+
+}  // namespace
+
 void open_libs(std::filesystem::path const& filesDir) noexcept {
+  std::unique_lock lock(registry_mutex);
   current_load_phase = CLoadPhase::LoadPhase_Libs;
-  // Not thread safe: mutates skip_load
   LOG_DEBUG("Opening libs using root: {}", filesDir.c_str());
-  auto lib_sos = listAllObjectsInPhase(filesDir, LoadPhase::Libs);
-  LOG_DEBUG("Found: {} candidates! Attempting to load them...", lib_sos.size());
+  if (get_config().failureCache) {
+    auto environment = environment_key(filesDir);
+    if (environment) {
+      failure_cache::load(filesDir / failure_cache::kCacheName, *environment);
+    } else {
+      get_config().failureCache = false;
+    }
+  }
+  // Nothing in the files dir changes after staging, so every phase is planned up front from one scan
+  pending_plans = planPhases(filesDir);
+  load_root = filesDir;
+  deferred_mods = listDeferredMods(filesDir);
+  if (!deferred_mods.empty()) {
+    LOG_INFO("Deferring: {} mods until they are required", deferred_mods.size());
+  }
+  // Every phase has been scanned now, persist before any mod code runs
+  if (!elf_metadata::save()) {
+    LOG_WARN("Failed to write ELF metadata cache, the next launch will parse every object again");
+  }
   // TODO: Libs are stored as LoadedMod which is redundant
-  loaded_libs = loadMods(lib_sos, filesDir, skip_load, LoadPhase::Libs);
+  loaded_libs = open_phase(filesDir, LoadPhase::Libs);
   // Report errors
   for (auto& l : loaded_libs) {
     if (auto* fail = std::get_if<FailedMod>(&l)) {
@@ -177,29 +416,27 @@ void open_libs(std::filesystem::path const& filesDir) noexcept {
 void open_early_mods(std::filesystem::path const& filesDir) noexcept {
   current_load_phase = CLoadPhase::LoadPhase_EarlyMods;
   // Construct early mods
-  // Not thread safe: mutates skip_load, initializes in sequential order
-  auto early_mod_sos = listAllObjectsInPhase(filesDir, LoadPhase::EarlyMods);
-  loaded_early_mods = loadMods(early_mod_sos, filesDir, skip_load, LoadPhase::EarlyMods);
-  // Call initialize and report errors
-  for (auto& m : loaded_early_mods) {
-    if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
-      // Call init, note that it is a mutable call
-      if (!loaded_mod->init()) {
-        // Setup call does not exist, but the mod was still loaded
-        LOG_INFO("No setup on mod: {}", loaded_mod->object.path.c_str());
-      }
-    } else if (auto* fail = std::get_if<FailedMod>(&m)) {
-      LOG_WARN("Skipping setup call on: {} because it failed: {}", fail->object.path.c_str(), fail->failure.c_str());
-    }
+  {
+    std::unique_lock lock(registry_mutex);
+    loaded_early_mods = open_phase(filesDir, LoadPhase::EarlyMods);
   }
+  // Call initialize and report errors, thread safe mods are set up in parallel
+  setupMods(loaded_early_mods, filesDir);
   early_mods_opened = true;
 }
 
 void open_mods(std::filesystem::path const& filesDir) noexcept {
   current_load_phase = CLoadPhase::LoadPhase_Mods;
   // Construct mods (aka 'late' unity mods), should be happening after unity is inited (first scene loaded)
-  auto mod_sos = listAllObjectsInPhase(filesDir, LoadPhase::Mods);
-  loaded_mods = loadMods(mod_sos, filesDir, skip_load, LoadPhase::Mods);
+  {
+    std::unique_lock lock(registry_mutex);
+    loaded_mods = open_phase(filesDir, LoadPhase::Mods);
+    if (!failure_cache::save()) {
+      LOG_WARN("Failed to write failure cache, the next launch will open failed objects again");
+    }
+  }
+  // Every phase is open, nothing reads the objects we mapped anymore
+  ElfImage::clearCache();
 
   LOG_INFO("Found late mods:");
   for (auto& m : loaded_mods) {
@@ -208,18 +445,10 @@ void open_mods(std::filesystem::path const& filesDir) noexcept {
     }
   }
   
-  // Call initialize and report errors
-  for (auto& m : loaded_mods) {
-    if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
-      // Call init, note that it is a mutable call
-      if (!loaded_mod->init()) {
-        // Setup call does not exist, but the mod was still loaded
-        LOG_INFO("No setup on mod: {}", loaded_mod->object.path.c_str());
-      }
-    } else if (auto* fail = std::get_if<FailedMod>(&m)) {
-      LOG_WARN("Skipping setup call on: {} because it failed: {}", fail->object.path.c_str(), fail->failure.c_str());
-    }
-  }
+  // Call initialize and report errors, thread safe mods are set up in parallel
+  setupMods(loaded_mods, filesDir);
+  // Every phase is open and set up, deferred mods and the late_load order scan whatever they need again
+  clearScanned();
   late_mods_opened = true;
 }
 
@@ -241,6 +470,7 @@ void load_early_mods() noexcept {
 
 // calls late_load on mods and early mods
 void load_mods() noexcept {
+  std::unique_lock lock(registry_mutex);
   LOG_DEBUG("Early mods to late load:");
   for (auto const& m : loaded_early_mods) {
     if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
@@ -248,21 +478,6 @@ void load_mods() noexcept {
     }
   }
 
-  // call late_load on all early mods
-  for (auto& m : loaded_early_mods) {
-    if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
-      LOG_DEBUG("Attempting to call late_load on early mod: {}", loaded_mod->object.path.c_str());
-      if (!loaded_mod->late_load()) {
-        // Late load call does not exist, but the mod was still loaded
-        LOG_INFO("No late_load function on early mod: {}", loaded_mod->object.path.c_str());
-      }
-    } else if (auto* fail = std::get_if<FailedMod>(&m)) {
-      LOG_WARN("Skipping load_late call on: {} because it failed to be constructed: {}", fail->object.path.c_str(),
-               fail->failure.c_str());
-    }
-  }
-
-  // call late_load on all mods
   LOG_DEBUG("Late mods to late load:");
   for (auto const& m : loaded_mods) {
     if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
@@ -270,22 +485,47 @@ void load_mods() noexcept {
     }
   }
 
-  for (auto& m : loaded_mods) {
-    if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
-      LOG_DEBUG("Attempting to call late_load on mod: {} {}", loaded_mod->object.path.c_str(), fmt::ptr(loaded_mod->late_loadFn.value_or(nullptr)));
-      if (!loaded_mod->late_load()) {
-        // Load call does not exist, but the mod was still loaded
+  // call late_load on all early mods, then on all mods
+  std::vector<LoadedMod*> mods{};
+  mods.reserve(loaded_early_mods.size() + loaded_mods.size());
+  for (auto* results : { &loaded_early_mods, &loaded_mods }) {
+    for (auto& m : *results) {
+      if (auto* loaded_mod = std::get_if<LoadedMod>(&m)) {
+        mods.push_back(loaded_mod);
+      } else if (auto* fail = std::get_if<FailedMod>(&m)) {
+        LOG_WARN("Skipping late_load call on: {} because it failed to be constructed: {}", fail->object.path.c_str(),
+                 fail->failure.c_str());
+      }
+    }
+  }
+  lock.unlock();
+  lateLoadMods(mods, load_root);
+
+  // Deferred mods opened so far, including any opened by the late_load calls, which append to the deque. Whoever
+  // opens one after the last was taken here calls late_load on it themselves, which is decided under the same lock.
+  for (size_t i = 0;; i++) {
+    lock.lock();
+    if (i == loaded_deferred_mods.size()) {
+      mods_late_loaded = true;
+      break;
+    }
+    auto* loaded_mod = std::get_if<LoadedMod>(&loaded_deferred_mods[i]);
+    lock.unlock();
+    if (loaded_mod != nullptr) {
+      LOG_DEBUG("Attempting to call late_load on deferred mod: {}", loaded_mod->object.path.c_str());
+      // Whoever opened it may not have set it up yet, setup always comes first. Does nothing if it has been already.
+      setupNow(*loaded_mod);
+      // Background late_loads of the mods it depends on may still be running
+      if (!lateLoadAfterDependencies(*loaded_mod)) {
         LOG_INFO("No late_load function on mod: {}", loaded_mod->object.path.c_str());
       }
-    } else if (auto* fail = std::get_if<FailedMod>(&m)) {
-      LOG_WARN("Skipping late_load call on: {} because it failed to be constructed: {}", fail->object.path.c_str(),
-               fail->failure.c_str());
     }
   }
 }
 
 /// Gets all loaded objects for a particular phase
 std::vector<ModData> get_for(LoadPhase phase) noexcept {
+  std::unique_lock lock(registry_mutex);
   std::vector<ModData> result{};
   auto callback = [&result](auto const& m) {
     if (auto const* mod = std::get_if<LoadedMod>(&m)) {
@@ -302,8 +542,9 @@ std::vector<ModData> get_for(LoadPhase phase) noexcept {
       std::for_each(loaded_early_mods.cbegin(), loaded_early_mods.cend(), callback);
     } break;
     case LoadPhase::Mods: {
-      result.reserve(loaded_mods.size());
+      result.reserve(loaded_mods.size() + loaded_deferred_mods.size());
       std::for_each(loaded_mods.cbegin(), loaded_mods.cend(), callback);
+      std::for_each(loaded_deferred_mods.cbegin(), loaded_deferred_mods.cend(), callback);
     } break;
     default:
       break;
@@ -312,8 +553,9 @@ std::vector<ModData> get_for(LoadPhase phase) noexcept {
 }
 /// Gets all loaded libs, early mods, and mods and returns the ModResult types.
 std::vector<ModData> get_loaded() noexcept {
+  std::unique_lock lock(registry_mutex);
   std::vector<ModData> result{};
-  result.reserve(loaded_libs.size() + loaded_early_mods.size() + loaded_mods.size());
+  result.reserve(loaded_libs.size() + loaded_early_mods.size() + loaded_mods.size() + loaded_deferred_mods.size());
   auto callback = [&result](auto const& m) {
     if (auto const* mod = std::get_if<LoadedMod>(&m)) {
       result.emplace_back(*mod);
@@ -322,13 +564,15 @@ std::vector<ModData> get_loaded() noexcept {
   std::for_each(loaded_libs.cbegin(), loaded_libs.cend(), callback);
   std::for_each(loaded_early_mods.cbegin(), loaded_early_mods.cend(), callback);
   std::for_each(loaded_mods.cbegin(), loaded_mods.cend(), callback);
+  std::for_each(loaded_deferred_mods.cbegin(), loaded_deferred_mods.cend(), callback);
   return result;
 }
 
 /// Gets all loaded libs, early mods, and mods and returns the ModResult types.
 std::vector<ModResult> get_all() noexcept {
+  std::unique_lock lock(registry_mutex);
   std::vector<ModResult> result{};
-  result.reserve(loaded_libs.size() + loaded_early_mods.size() + loaded_mods.size());
+  result.reserve(loaded_libs.size() + loaded_early_mods.size() + loaded_mods.size() + loaded_deferred_mods.size());
   auto callback = [&result](auto const& m) {
     if (auto const* mod = std::get_if<LoadedMod>(&m)) {
       auto modData = static_cast<ModData>(*mod);
@@ -337,16 +581,67 @@ std::vector<ModResult> get_all() noexcept {
     }
 
     auto const& failedMod = std::get<FailedMod>(m);
-    FailedMod copiedFailure{ SharedObject(failedMod.object), failedMod.failure, failedMod.dependencies };
+    FailedMod copiedFailure{ SharedObject(failedMod.object), failedMod.failure, failedMod.dependencyGraph };
     result.emplace_back(std::move(copiedFailure));
   };
   std::for_each(loaded_libs.cbegin(), loaded_libs.cend(), callback);
   std::for_each(loaded_early_mods.cbegin(), loaded_early_mods.cend(), callback);
   std::for_each(loaded_mods.cbegin(), loaded_mods.cend(), callback);
+  std::for_each(loaded_deferred_mods.cbegin(), loaded_deferred_mods.cend(), callback);
   return result;
 }
 
+std::optional<ModResult> open_deferred(std::string_view name) noexcept {
+  auto* result = open_deferred_named(name, false);
+  std::unique_lock lock(registry_mutex);
+  if (result == nullptr) {
+    // Opened before, either explicitly or because it was required
+    auto found = std::find_if(loaded_deferred_mods.begin(), loaded_deferred_mods.end(), [name](LoadResult const& r) {
+      auto const* loaded = std::get_if<LoadedMod>(&r);
+      auto const* failed = std::get_if<FailedMod>(&r);
+      return namesObject(name, loaded != nullptr ? loaded->object.path : failed->object.path, false);
+    });
+    if (found == loaded_deferred_mods.end()) {
+      return std::nullopt;
+    }
+    result = &*found;
+  }
+  if (auto const* loaded = std::get_if<LoadedMod>(result)) {
+    return ModData(*loaded);
+  }
+  auto const& failed = std::get<FailedMod>(*result);
+  return FailedMod{ SharedObject(failed.object), failed.failure, failed.dependencyGraph };
+}
+
+std::vector<std::filesystem::path> get_deferred() noexcept {
+  std::unique_lock lock(registry_mutex);
+  std::vector<std::filesystem::path> paths{};
+  paths.reserve(deferred_mods.size());
+  for (auto const& mod : deferred_mods) {
+    paths.push_back(mod.path);
+  }
+  return paths;
+}
+
+std::optional<uint64_t> get_content_hash(std::filesystem::path const& path) noexcept {
+  return staging::content_hash_of(path);
+}
+
+LoadPolicy get_policy(std::filesystem::path const& path) noexcept {
+  return policy_of(path);
+}
+
+void await_late_loads() noexcept {
+  awaitLateLoads();
+}
+
+bool late_loads_finished() noexcept {
+  return lateLoadsFinished();
+}
+
 void close_all() noexcept {
+  awaitLateLoads();
+  std::unique_lock lock(registry_mutex);
   constexpr auto try_close = [](LoadResult& r) {
     if (auto* loaded = std::get_if<LoadedMod>(&r)) {
       if (auto err = loaded->close()) {
@@ -358,7 +653,9 @@ void close_all() noexcept {
   std::for_each(loaded_mods.begin(), loaded_mods.end(), try_close);
   std::for_each(loaded_early_mods.begin(), loaded_early_mods.end(), try_close);
   std::for_each(loaded_libs.begin(), loaded_libs.end(), try_close);
+  std::for_each(loaded_deferred_mods.begin(), loaded_deferred_mods.end(), try_close);
   loaded_libs.clear();
+  loaded_deferred_mods.clear();
   loaded_early_mods.clear();
   loaded_mods.clear();
 }
@@ -383,7 +680,7 @@ std::optional<std::reference_wrapper<LoadedMod>> get_mod(ModInfo info, MatchType
     kFailed,
     kSuccess,
   };
-  constexpr static auto try_unload = [](std::vector<LoadResult>& results, auto const& find_match) -> LoadedMod* {
+  constexpr static auto try_unload = [](auto& results, auto const& find_match) -> LoadedMod* {
     auto found = std::find_if(results.begin(), results.end(), find_match);
     if (found == results.end()) {
       return nullptr;
@@ -400,10 +697,27 @@ std::optional<std::reference_wrapper<LoadedMod>> get_mod(ModInfo info, MatchType
   // Now search the lists.
   // Start with the "best" matches first, ex: mods, then try early_mods
   // libs will never have ANY info
+  std::unique_lock lock(registry_mutex);
   auto* result = try_unload(loaded_mods, find_match);
   if (result == nullptr) {
     result = try_unload(loaded_early_mods, find_match);
   }
+  if (result == nullptr) {
+    result = try_unload(loaded_deferred_mods, find_match);
+  }
+  lock.unlock();
+  if (result == nullptr) {
+    // Not opened yet, the id is all there is to go on until setup reports the rest. Once it has, it has to match the
+    // same way the mods opened before it do.
+    if (auto* opened = std::get_if<LoadedMod>(open_deferred_named(info.id, true))) {
+      lock.lock();
+      result = try_unload(loaded_deferred_mods, find_match);
+      if (result == nullptr) {
+        LOG_WARN("Deferred mod: {} was required as: {} but reports: {}", opened->object.path.c_str(), info,
+                 opened->modInfo);
+      }
+    }
+  }
   if (result == nullptr) {
     return std::nullopt;
   }
@@ -413,6 +727,8 @@ std::optional<std::reference_wrapper<LoadedMod>> get_mod(ModInfo info, MatchType
 
 bool force_unload(ModInfo info, MatchType match_type) noexcept {
   // TODO: Use modloader::get_mod instead
+  // Nothing may be closed or moved while late_loads still run in the background
+  awaitLateLoads();
 
   LOG_DEBUG("Attempting to force unload: {}", info);
   // First, see if we have a mod that matches
@@ -433,7 +749,7 @@ bool force_unload(ModInfo info, MatchType match_type) noexcept {
     kFailed,
     kSuccess,
   };
-  constexpr static auto try_unload = [](std::vector<LoadResult>& results, auto const& find_match) -> UnloadResult {
+  constexpr static auto try_unload = [](auto& results, auto const& find_match) -> UnloadResult {
     auto found = std::find_if(results.begin(), results.end(), find_match);
     if (found == results.end()) {
       return UnloadResult::kNotFound;
@@ -451,17 +767,23 @@ bool force_unload(ModInfo info, MatchType match_type) noexcept {
   // Now search the lists.
   // Start with the "best" matches first, ex: mods, then try early_mods
   // libs will never have ANY info
+  std::unique_lock lock(registry_mutex);
   auto result = try_unload(loaded_mods, find_match);
   if (result == UnloadResult::kNotFound) {
     result = try_unload(loaded_early_mods, find_match);
   }
+  if (result == UnloadResult::kNotFound) {
+    result = try_unload(loaded_deferred_mods, find_match);
+  }
   return result == UnloadResult::kSuccess || result == UnloadResult::kNotFound;
 }
 
 }  // namespace modloader
 
 MODLOADER_FUNC CModResult modloader_get_mod(CModInfo* info, CMatchType match_type) {
-  auto modResult = modloader::get_mod(modloader::ModInfo(*info), modloader::from_c_match_type(match_type));
+  auto modResult = match_type == MatchType_ObjectName
+                       ? modloader::get_mod_by_object(info->id != nullptr ? info->id : "")
+                       : modloader::get_mod(modloader::ModInfo(*info), modloader::from_c_match_type(match_type));
 
   if (!modResult.has_value()) {
     return {};
@@ -547,10 +869,40 @@ MODLOADER_FUNC void modloader_free_results(CModResults* results) {
   delete[] results->array;
 }
 
+MODLOADER_FUNC bool modloader_get_content_hash(char const* path, uint64_t* hash) {
+  if (path == nullptr || hash == nullptr) {
+    return false;
+  }
+  auto result = modloader::get_content_hash(path);
+  if (!result) {
+    return false;
+  }
+  *hash = *result;
+  return true;
+}
+
+MODLOADER_FUNC bool modloader_get_policy(char const* path, CLoadPolicy* policy) {
+  if (path == nullptr || policy == nullptr) {
+    return false;
+  }
+  *policy = modloader::get_policy(path).to_c();
+  return true;
+}
+
+MODLOADER_FUNC void modloader_await_late_loads() {
+  modloader::await_late_loads();
+}
+
+MODLOADER_FUNC bool modloader_late_loads_finished() {
+  return modloader::late_loads_finished();
+}
+
 MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType match_type) {
   LOG_VERBOSE("Mod {} is being attempted to load!", info->id);
 
-  auto result = modloader::get_mod(modloader::ModInfo(*info), modloader::from_c_match_type(match_type));
+  auto result = match_type == MatchType_ObjectName
+                    ? modloader::get_mod_by_object(info->id != nullptr ? info->id : "")
+                    : modloader::get_mod(modloader::ModInfo(*info), modloader::from_c_match_type(match_type));
 
   if (!result) {
     LOG_ERROR("Unable to find {}", info->id);
@@ -566,7 +918,7 @@ MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType
     case modloader::LoadPhase::Shim:
       break;
     case modloader::LoadPhase::EarlyMods:
-      if (!loadedMod.init()) {
+      if (!modloader::setupNow(loadedMod)) {
         LOG_ERROR("Unable to init {}", loadedMod.modInfo.id);
         return CLoadResultEnum::LoadResult_Failed;
       }
@@ -582,7 +934,7 @@ MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType
       // if late load
       if (current_load_phase == CLoadPhase::LoadPhase_Mods) {
         LOG_VERBOSE("Attempting to late load early mod {}!", info->id);
-        if (!loadedMod.late_load()) {
+        if (!modloader::lateLoadNow(loadedMod)) {
           LOG_ERROR("Unable to late load {}", loadedMod.modInfo.id);
           return CLoadResultEnum::LoadResult_Failed;
         }
@@ -590,7 +942,7 @@ MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType
 
       break;
     case modloader::LoadPhase::Mods:
-      if (!loadedMod.init()) {
+      if (!modloader::setupNow(loadedMod)) {
         LOG_ERROR("Unable to init {}", loadedMod.modInfo.id);
         return CLoadResultEnum::LoadResult_Failed;
       }
@@ -598,7 +950,7 @@ MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType
       // if late load
       if (current_load_phase == CLoadPhase::LoadPhase_Mods) {
         LOG_VERBOSE("Attempting to late load late mod {}!", info->id);
-        if (!loadedMod.late_load()) {
+        if (!modloader::lateLoadNow(loadedMod)) {
           LOG_ERROR("Unable to late load {}", loadedMod.modInfo.id);
           return CLoadResultEnum::LoadResult_Failed;
         }
@@ -608,4 +960,16 @@ MODLOADER_FUNC CLoadResultEnum modloader_require_mod(CModInfo* info, CMatchType
   return CLoadResultEnum::MatchType_Loaded;
 }
 
+MODLOADER_FUNC CLoadResultEnum modloader_open_deferred(char const* name) {
+  if (name == nullptr) {
+    return CLoadResultEnum::LoadResult_NotFound;
+  }
+  auto result = modloader::open_deferred(name);
+  if (!result) {
+    return CLoadResultEnum::LoadResult_NotFound;
+  }
+  return std::holds_alternative<modloader::ModData>(*result) ? CLoadResultEnum::MatchType_Loaded
+                                                             : CLoadResultEnum::LoadResult_Failed;
+}
+
 #endif
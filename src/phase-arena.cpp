@@ -0,0 +1,20 @@
+#include "phase-arena.hpp"
+
+namespace modloader {
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+  allocationCount++;
+  byteCount += bytes;
+  return upstream->allocate(bytes, alignment);
+}
+
+void CountingResource::do_deallocate(void* pointer, size_t bytes, size_t alignment) {
+  upstream->deallocate(pointer, bytes, alignment);
+}
+
+bool CountingResource::do_is_equal(std::pmr::memory_resource const& other) const noexcept {
+  // Without RTTI, only the same instance is known to be interchangeable
+  return this == &other;
+}
+
+}  // namespace modloader
@@ -0,0 +1,102 @@
+#include "prefetcher.hpp"
+#include "file-handles.hpp"
+#include "log.h"
+#include "staging.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+
+namespace modloader {
+
+Prefetcher::Prefetcher(DependencyGraph const& graph, std::span<DependencyGraph::NodeId const> order, uint64_t budget)
+    : graph(graph),
+      order(order.begin(), order.end()),
+      positions(graph.size(), kNotPlanned),
+      sizes(order.size(), 0),
+      budget(budget) {
+  for (size_t i = 0; i < order.size(); i++) {
+    // A node opened twice is only read ahead of its first open
+    if (positions[order[i]] == kNotPlanned) {
+      positions[order[i]] = static_cast<uint32_t>(i);
+    }
+  }
+  worker = std::thread([this] { run(); });
+}
+
+Prefetcher::~Prefetcher() {
+  {
+    std::unique_lock lock(mutex);
+    stopping = true;
+  }
+  moved.notify_all();
+  worker.join();
+  LOG_DEBUG("Read ahead: {} of: {} objects ({} bytes) before opening them", prefetched, order.size(), prefetchedBytes);
+}
+
+void Prefetcher::opening(DependencyGraph::NodeId id) noexcept {
+  auto position = id < positions.size() ? positions[id] : kNotPlanned;
+  {
+    std::unique_lock lock(mutex);
+    if (position == kNotPlanned || position <= cursor) {
+      return;
+    }
+    for (; cursor < position; cursor++) {
+      inFlight -= sizes[cursor];
+      sizes[cursor] = 0;
+    }
+  }
+  moved.notify_all();
+}
+
+size_t Prefetcher::readAhead() const noexcept {
+  std::unique_lock lock(mutex);
+  return prefetched;
+}
+
+void Prefetcher::run() noexcept {
+  for (size_t next = 0; next < order.size(); next++) {
+    auto const& path = graph.path(order[next]);
+    {
+      std::unique_lock lock(mutex);
+      if (stopping) {
+        return;
+      }
+      // Already opened, or a repeat of a node that was read ahead before
+      if (next < cursor || positions[order[next]] != next) {
+        continue;
+      }
+    }
+    if (staging::find_memfd(path) != nullptr) {
+      continue;
+    }
+    UniqueFd fd(open64(path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat64 st {};
+    if (fd.fd == -1 || fstat64(fd.fd, &st) != 0) {
+      LOG_DEBUG("Not reading ahead: {}: {}", path.c_str(), std::strerror(errno));
+      continue;
+    }
+    auto size = static_cast<uint64_t>(st.st_size);
+    {
+      std::unique_lock lock(mutex);
+      moved.wait(lock, [&] { return stopping || next < cursor || inFlight == 0 || inFlight + size <= budget; });
+      if (stopping) {
+        return;
+      }
+      if (next < cursor) {
+        continue;
+      }
+      sizes[next] = size;
+      inFlight += size;
+      prefetched++;
+      prefetchedBytes += size;
+    }
+    // readahead only starts the reads, so this returns long before the object is in memory
+    if (readahead(fd.fd, 0, size) != 0 && posix_fadvise(fd.fd, 0, 0, POSIX_FADV_WILLNEED) != 0) {
+      LOG_DEBUG("Failed to read ahead: {}: {}", path.c_str(), std::strerror(errno));
+    }
+  }
+}
+
+}  // namespace modloader
@@ -0,0 +1,889 @@
+#include "staging.hpp"
+#include "config.hpp"
+#include "content-hash.hpp"
+#include "file-handles.hpp"
+#include "log.h"
+#include "thread-pool.hpp"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/memfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using modloader::Mapping;
+using modloader::UniqueFd;
+
+/// @brief Which in-kernel copies are still worth attempting for the file being copied.
+/// Once one fails, the rest of the file goes through the next one.
+struct KernelCopy {
+  bool copyFileRange = true;
+  bool sendfile = true;
+};
+
+/// @brief Copies length bytes at offset of in to the same offset of out without bouncing them through userspace.
+/// Tries copy_file_range, then sendfile for whatever copy_file_range did not get to.
+/// @return The number of bytes copied, which is short of length once neither can continue
+size_t copy_in_kernel(int in, int out, off64_t offset, size_t length, KernelCopy& kernel) {
+  size_t done = 0;
+  while (kernel.copyFileRange && done < length) {
+    loff_t in_offset = offset + done;
+    loff_t out_offset = offset + done;
+    // Not every libc we build against has a wrapper for this, go through the syscall directly
+    auto count = syscall(__NR_copy_file_range, in, &in_offset, out, &out_offset, length - done, 0U);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) {
+      kernel.copyFileRange = false;
+      break;
+    }
+    done += count;
+  }
+  // sendfile always writes at the file position of out
+  if (kernel.sendfile && done < length && lseek64(out, offset + done, SEEK_SET) < 0) {
+    kernel.sendfile = false;
+  }
+  while (kernel.sendfile && done < length) {
+    off64_t in_offset = offset + done;
+    auto count = sendfile64(out, in, &in_offset, length - done);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) {
+      kernel.sendfile = false;
+      break;
+    }
+    done += count;
+  }
+  return done;
+}
+
+/// @brief Writes all of bytes to out at offset
+bool write_all(int out, std::span<uint8_t const> bytes, off64_t offset) {
+  for (size_t written = 0; written < bytes.size();) {
+    auto count = pwrite64(out, bytes.data() + written, bytes.size() - written, offset + written);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    written += count;
+  }
+  return true;
+}
+
+/// @brief Copies length bytes at offset of in to the same offset of out through buffer, hashing them along the way
+bool copy_buffered(int in, int out, off64_t offset, size_t length, std::vector<uint8_t>& buffer,
+                   content_hash::Hasher* hasher) {
+  for (size_t done = 0; done < length;) {
+    auto amount = pread64(in, buffer.data(), std::min(buffer.size(), length - done), offset + done);
+    if (amount < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (amount == 0) {
+      // The source shrank while we were copying it
+      errno = EIO;
+      return false;
+    }
+    std::span<uint8_t const> bytes(buffer.data(), amount);
+    if (hasher) {
+      hasher->update(bytes);
+    }
+    if (!write_all(out, bytes, offset + done)) {
+      return false;
+    }
+    done += amount;
+  }
+  return true;
+}
+
+/// @brief Syncs the entries of dir, making the renames into it durable
+bool sync_directory(std::filesystem::path const& dir) {
+  UniqueFd fd(open64(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (fd.fd == -1 || fsync(fd.fd) != 0) {
+    LOG_ERROR("Failed to sync directory: {}: {}", dir.c_str(), std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/// @brief Which strategies are still worth attempting for the phase being staged.
+/// Once a strategy fails because the filesystem cannot do it, no other file in the phase will try it again.
+struct StrategySupport {
+  std::atomic<bool> reflink = true;
+};
+
+/// @brief Shares the extents of in with out copy-on-write, only usable on filesystems that support FICLONE
+bool try_reflink(int in, int out, std::filesystem::path const& from, StrategySupport& support) {
+  if (!support.reflink) {
+    return false;
+  }
+  if (ioctl(out, FICLONE, in) == 0) {
+    return true;
+  }
+  LOG_DEBUG("Failed to reflink: {}: {}", from.c_str(), std::strerror(errno));
+  // Only these say anything about the filesystems involved, anything else may just be this file
+  if (errno == EOPNOTSUPP || errno == EXDEV || errno == ENOTTY) {
+    support.reflink = false;
+  }
+  return false;
+}
+
+constexpr static size_t kCopyWindowSize = 1024 * 1024;
+
+/// @brief Copies all of in to out a window at a time.
+/// Each window is copied in-kernel where possible, and whatever the kernel could not copy is finished through a
+/// buffer, so a copy that fails partway does not have to start over.
+/// When content hashing is enabled, each window is first hashed from a mapping of in, so the in-kernel copy after it
+/// is served from the page cache and the source is still only read once. If in cannot be mapped, every window is
+/// copied through the buffer instead so the bytes can be hashed.
+/// @param hash Filled with the hash of the copied bytes, or 0 when content hashing is disabled
+bool copy_contents(int in, int out, size_t size, std::filesystem::path const& from, uint64_t& hash) {
+  hash = 0;
+  auto hashing = modloader::get_config().contentHashing;
+  std::optional<Mapping> mapping;
+  if (hashing) {
+    mapping.emplace(in, size);
+    if (!mapping->valid()) {
+      LOG_WARN("Failed to mmap: {} for hashing, copying through a buffer: {}", from.c_str(), std::strerror(errno));
+      mapping.reset();
+    }
+  }
+  thread_local std::vector<uint8_t> buffer(kCopyWindowSize);
+  content_hash::Hasher hasher{};
+  KernelCopy kernel{};
+  for (size_t offset = 0; offset < size; offset += kCopyWindowSize) {
+    auto length = std::min(kCopyWindowSize, size - offset);
+    size_t done = 0;
+    if (mapping) {
+      hasher.update(mapping->bytes().subspan(offset, length));
+    }
+    if (!hashing || mapping) {
+      done = copy_in_kernel(in, out, offset, length, kernel);
+    }
+    bool copied = true;
+    if (done < length) {
+      if (mapping) {
+        copied = write_all(out, mapping->bytes().subspan(offset + done, length - done), offset + done);
+      } else {
+        copied = copy_buffered(in, out, offset + done, length - done, buffer, hashing ? &hasher : nullptr);
+      }
+    }
+    if (!copied) {
+      LOG_ERROR("Failed to copy: {}, copied: {} of: {} bytes: {}", from.c_str(), offset + done, size,
+                std::strerror(errno));
+      return false;
+    }
+  }
+  if (mapping) {
+    // Let the kernel drop these pages early, the copy is what will be loaded
+    madvise(mapping->address, size, MADV_DONTNEED);
+  }
+  if (hashing) {
+    hash = hasher.finish();
+  }
+  return true;
+}
+
+/// @brief Stages from to a temporary file next to to, syncs it, then renames it over to.
+/// A partially written copy is therefore never visible under the final name. The rename itself is only durable once
+/// the directory of to is synced, see @ref sync_directory.
+/// Tries a reflink first, and only copies the bytes when that does not work. Copied bytes are hashed in the same pass
+/// that copies them. Reflinks never pass the bytes through us, so they are not hashed at all.
+/// @param record Filled with the identity of the source that was read, and the hash of the bytes that were copied, 0
+/// for reflinks
+/// @param strategy Filled with the strategy that was used to stage the file
+bool copy_file(std::filesystem::path const& from, std::filesystem::path const& to, StrategySupport& support,
+               staging::FileRecord& record, staging::Strategy& strategy) {
+  UniqueFd in(open64(from.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd == -1) {
+    LOG_ERROR("Failed to open: {} for staging: {}", from.c_str(), std::strerror(errno));
+    return false;
+  }
+  struct stat64 st {};
+  if (fstat64(in.fd, &st) != 0) {
+    LOG_ERROR("Failed to stat: {} for staging: {}", from.c_str(), std::strerror(errno));
+    return false;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  auto tmp = to;
+  tmp += ".tmp";
+  uint64_t hash = 0;
+  {
+    UniqueFd out(open64(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777));
+    if (out.fd == -1) {
+      LOG_ERROR("Failed to create: {} for staging: {}", tmp.c_str(), std::strerror(errno));
+      return false;
+    }
+    if (try_reflink(in.fd, out.fd, from, support)) {
+      strategy = staging::Strategy::Reflink;
+    } else {
+      strategy = staging::Strategy::Copy;
+      if (!copy_contents(in.fd, out.fd, size, from, hash)) {
+        return false;
+      }
+    }
+    // Otherwise a crash after the rename can leave a torn copy under the identity the manifest records
+    if (fsync(out.fd) != 0) {
+      LOG_ERROR("Failed to sync: {}: {}", tmp.c_str(), std::strerror(errno));
+      return false;
+    }
+  }
+  // A source written to while we copied it leaves a torn copy behind, whose hash describes neither version
+  struct stat64 after {};
+  if (fstat64(in.fd, &after) != 0 || !staging::identity_of(after).same_identity(staging::identity_of(st))) {
+    LOG_ERROR("Source: {} changed while it was being staged", from.c_str());
+    return false;
+  }
+  if (rename(tmp.c_str(), to.c_str()) != 0) {
+    LOG_ERROR("Failed to rename: {} to: {}: {}", tmp.c_str(), to.c_str(), std::strerror(errno));
+    return false;
+  }
+  struct stat64 staged_st {};
+  if (stat64(to.c_str(), &staged_st) != 0) {
+    LOG_ERROR("Failed to stat staged file: {}: {}", to.c_str(), std::strerror(errno));
+    return false;
+  }
+  auto staged = staging::identity_of(staged_st);
+  record = staging::identity_of(st);
+  record.hash = hash;
+  record.stagedSize = staged.size;
+  record.stagedMtime = staged.mtime;
+  record.stagedInode = staged.inode;
+  return true;
+}
+
+/// @brief All memfd staged objects, keyed by the path they would have been staged to.
+/// Only mutated while staging, which happens before anything is loaded.
+std::unordered_map<std::string, staging::MemfdObject>& memfd_objects() {
+  static std::unordered_map<std::string, staging::MemfdObject> objects{};
+  return objects;
+}
+bool memfd_staging_used = false;
+
+/// @brief The hash an on-disk staged object was staged with
+struct StagedHash {
+  uint64_t hash;
+  // Identity of the staged copy when its bytes were hashed
+  staging::FileRecord staged;
+  // Checked against staged by verify_staged since
+  bool verified;
+};
+
+/// @brief The hash every on-disk staged object was staged with, keyed by its staged path.
+/// Filled while staging, which happens before anything is loaded. Afterwards, only verifying an object changes it.
+std::unordered_map<std::string, StagedHash>& staged_hashes() {
+  static std::unordered_map<std::string, StagedHash> hashes{};
+  return hashes;
+}
+
+/// @brief Streams from into a new sealed memfd
+/// @return The memfd on success, nullopt otherwise
+std::optional<staging::MemfdObject> stream_to_memfd(std::filesystem::path const& from) {
+  UniqueFd in(open64(from.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd == -1) {
+    LOG_ERROR("Failed to open: {} for staging: {}", from.c_str(), std::strerror(errno));
+    return std::nullopt;
+  }
+  struct stat64 st {};
+  if (fstat64(in.fd, &st) != 0) {
+    LOG_ERROR("Failed to stat: {} for staging: {}", from.c_str(), std::strerror(errno));
+    return std::nullopt;
+  }
+  // Not every libc we build against has a wrapper for this, go through the syscall directly
+  UniqueFd out(static_cast<int>(
+      syscall(__NR_memfd_create, from.filename().c_str(), static_cast<unsigned>(MFD_CLOEXEC | MFD_ALLOW_SEALING))));
+  if (out.fd == -1) {
+    LOG_ERROR("Failed to create memfd for: {}: {}", from.c_str(), std::strerror(errno));
+    return std::nullopt;
+  }
+  uint64_t hash = 0;
+  if (!copy_contents(in.fd, out.fd, static_cast<size_t>(st.st_size), from, hash)) {
+    return std::nullopt;
+  }
+  // Nobody may change the object out from under the linker
+  if (fcntl(out.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    LOG_ERROR("Failed to seal memfd for: {}: {}", from.c_str(), std::strerror(errno));
+    return std::nullopt;
+  }
+  auto proc_path = std::filesystem::path("/proc/self/fd") / std::to_string(out.fd);
+  std::error_code error_code;
+  auto realpath = std::filesystem::read_symlink(proc_path, error_code);
+  if (error_code) {
+    LOG_WARN("Failed to read link of: {}: {}", proc_path.c_str(), error_code.message().c_str());
+  }
+  staging::MemfdObject object{
+    .fd = out.fd,
+    .procPath = std::move(proc_path),
+    .realpath = realpath.string(),
+    .hash = hash,
+  };
+  // The memfd lives for the rest of the process now
+  out.fd = -1;
+  return object;
+}
+
+/// @brief First line of the manifest. Changed whenever the format changes, older manifests are discarded.
+constexpr static std::string_view kManifestHeader = "staging_manifest v2";
+
+/// @brief The part of relative before its last separator, "" for entries directly within the phase directory
+std::string_view parent_of(std::string_view relative) {
+  auto separator = relative.rfind('/');
+  return separator == std::string_view::npos ? std::string_view{} : relative.substr(0, separator);
+}
+
+/// @brief Lists every file under src, relative to it, and records the identity of every directory in listed.
+/// Directories with the identity they have in previous are not read again, their entries are taken from previous.
+/// @return false if src itself cannot be listed
+bool list_source(std::filesystem::path const& src, staging::PhaseManifest const& previous,
+                 staging::PhaseManifest& listed, std::vector<std::string>& files) {
+  // The entries of every directory in previous, which a directory is only listed with when its files all are
+  std::unordered_map<std::string_view, std::vector<std::pair<std::string const*, bool>>> children{};
+  for (auto const& [relative, record] : previous.files) {
+    children[parent_of(relative)].emplace_back(&relative, false);
+  }
+  for (auto const& [relative, record] : previous.directories) {
+    if (!relative.empty()) {
+      children[parent_of(relative)].emplace_back(&relative, true);
+    }
+  }
+
+  std::vector<std::string> pending{ "" };
+  size_t reused = 0;
+  while (!pending.empty()) {
+    auto relative = std::move(pending.back());
+    pending.pop_back();
+    auto dir = relative.empty() ? src : src / relative;
+    struct stat64 st {};
+    if (stat64(dir.c_str(), &st) != 0) {
+      if (relative.empty()) {
+        LOG_ERROR("Failed to stat source directory: {}: {}", src.c_str(), std::strerror(errno));
+        return false;
+      }
+      LOG_WARN("Failed to stat: {}, skipping it: {}", dir.c_str(), std::strerror(errno));
+      continue;
+    }
+    auto identity = staging::identity_of(st);
+    auto known = previous.directories.find(relative);
+    if (known != previous.directories.end() && known->second.same_identity(identity)) {
+      reused++;
+      if (auto it = children.find(relative); it != children.end()) {
+        for (auto [child, directory] : it->second) {
+          (directory ? pending : files).push_back(*child);
+        }
+      }
+    } else {
+      std::error_code error_code;
+      std::filesystem::directory_iterator iter(dir, error_code);
+      if (error_code) {
+        LOG_ERROR("Failed to iterate source directory: {}: {}", dir.c_str(), error_code.message().c_str());
+        if (relative.empty()) {
+          return false;
+        }
+        continue;
+      }
+      for (auto const& entry : iter) {
+        auto child = relative.empty() ? entry.path().filename().string()
+                                      : relative + '/' + entry.path().filename().string();
+        (entry.is_directory(error_code) ? pending : files).push_back(std::move(child));
+      }
+    }
+    listed.directories.insert_or_assign(std::move(relative), identity);
+  }
+  LOG_DEBUG("Listed source: {}, reusing the entries of: {} of: {} unchanged directories", src.c_str(), reused,
+            listed.directories.size());
+  return true;
+}
+
+/// @brief Splits line into its tab separated fields
+std::vector<std::string_view> split_fields(std::string_view line) {
+  std::vector<std::string_view> fields{};
+  while (true) {
+    auto tab = line.find('\t');
+    fields.push_back(line.substr(0, tab));
+    if (tab == std::string_view::npos) {
+      return fields;
+    }
+    line.remove_prefix(tab + 1);
+  }
+}
+
+template <typename T>
+bool parse_field(std::string_view field, T& value, int base = 10) {
+  auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value, base);
+  return error == std::errc{} && end == field.data() + field.size();
+}
+
+}  // namespace
+
+namespace staging {
+
+FileRecord identity_of(struct stat64 const& st) noexcept {
+  constexpr static int64_t kNsPerSec = 1'000'000'000;
+  return FileRecord{
+    .size = static_cast<uint64_t>(st.st_size),
+    .mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * kNsPerSec + st.st_mtim.tv_nsec,
+    .inode = static_cast<uint64_t>(st.st_ino),
+    .hash = 0,
+  };
+}
+
+std::string escape_field(std::string_view field) {
+  std::string escaped{};
+  escaped.reserve(field.size());
+  for (auto c : field) {
+    switch (c) {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '\t':
+        escaped += "\\t";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::optional<std::string> unescape_field(std::string_view field) {
+  std::string unescaped{};
+  unescaped.reserve(field.size());
+  for (size_t i = 0; i < field.size(); i++) {
+    if (field[i] != '\\') {
+      unescaped += field[i];
+      continue;
+    }
+    if (++i == field.size()) {
+      return std::nullopt;
+    }
+    switch (field[i]) {
+      case '\\':
+        unescaped += '\\';
+        break;
+      case 't':
+        unescaped += '\t';
+        break;
+      case 'n':
+        unescaped += '\n';
+        break;
+      default:
+        return std::nullopt;
+    }
+  }
+  return unescaped;
+}
+
+Manifest Manifest::read(std::filesystem::path const& path) noexcept {
+  Manifest manifest{};
+  std::ifstream file(path);
+  if (!file) {
+    LOG_DEBUG("No staging manifest at: {}, staging everything", path.c_str());
+    return manifest;
+  }
+  std::string line;
+  if (!std::getline(file, line) || line != kManifestHeader) {
+    LOG_INFO("Discarding staging manifest: {} written by another version", path.c_str());
+    return manifest;
+  }
+  // Each line is one of, with the phase and relative path escaped:
+  // d\t<phase>\t<relative path>\t<size>\t<mtime>\t<inode>
+  // f\t<phase>\t<relative path>\t<size>\t<mtime>\t<inode>\t<hash>\t<staged size>\t<staged mtime>\t<staged inode>
+  while (std::getline(file, line)) {
+    auto fields = split_fields(line);
+    auto directory = fields.size() == 6 && fields[0] == "d";
+    auto phase = fields.size() >= 3 ? unescape_field(fields[1]) : std::nullopt;
+    auto relative = fields.size() >= 3 ? unescape_field(fields[2]) : std::nullopt;
+    FileRecord record{};
+    bool valid = phase && relative && (directory || (fields.size() == 10 && fields[0] == "f")) &&
+                 parse_field(fields[3], record.size) && parse_field(fields[4], record.mtime) &&
+                 parse_field(fields[5], record.inode);
+    if (valid && !directory) {
+      valid = parse_field(fields[6], record.hash, 16) && parse_field(fields[7], record.stagedSize) &&
+              parse_field(fields[8], record.stagedMtime) && parse_field(fields[9], record.stagedInode);
+    }
+    if (!valid) {
+      LOG_WARN("Discarding malformed staging manifest: {}", path.c_str());
+      return Manifest{};
+    }
+    auto& records = manifest.phases[std::move(*phase)];
+    (directory ? records.directories : records.files).insert_or_assign(std::move(*relative), record);
+  }
+  return manifest;
+}
+
+bool Manifest::write(std::filesystem::path const& path) const noexcept {
+  auto tmp = path;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file) {
+      LOG_ERROR("Failed to open staging manifest: {} for writing", tmp.c_str());
+      return false;
+    }
+    file << kManifestHeader << '\n';
+    for (auto const& [phase, records] : phases) {
+      auto escaped_phase = escape_field(phase);
+      for (auto const& [relative, record] : records.directories) {
+        file << "d\t" << escaped_phase << '\t' << escape_field(relative) << '\t' << record.size << '\t'
+             << record.mtime << '\t' << record.inode << '\n';
+      }
+      for (auto const& [relative, record] : records.files) {
+        file << "f\t" << escaped_phase << '\t' << escape_field(relative) << '\t' << record.size << '\t'
+             << record.mtime << '\t' << record.inode << '\t' << std::hex << record.hash << std::dec << '\t'
+             << record.stagedSize << '\t' << record.stagedMtime << '\t' << record.stagedInode << '\n';
+      }
+    }
+    if (!file.flush()) {
+      LOG_ERROR("Failed to write staging manifest: {}", tmp.c_str());
+      return false;
+    }
+  }
+  std::error_code error_code;
+  std::filesystem::rename(tmp, path, error_code);
+  if (error_code) {
+    LOG_ERROR("Failed to replace staging manifest: {}: {}", path.c_str(), error_code.message().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool stage_phase(std::filesystem::path const& src, std::filesystem::path const& dst, PhaseManifest& manifest,
+                 modloader::ThreadPool& pool, PhaseStats& stats, Exclusions const& excluded) noexcept {
+  auto start = std::chrono::steady_clock::now();
+  stats = PhaseStats{};
+  std::error_code error_code;
+  // List the source, reading only the directories that changed since the last time
+  PhaseManifest listed{};
+  std::vector<std::string> files{};
+  if (!list_source(src, manifest, listed, files)) {
+    return false;
+  }
+  // Then collect the identity of every file we would stage, on the workers, since each stat may be slow
+  std::vector<std::optional<FileRecord>> identities(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    pool.submit([&identities, &files, &src, i] {
+      struct stat64 st {};
+      if (stat64((src / files[i]).c_str(), &st) != 0) {
+        LOG_WARN("Failed to stat: {}, skipping it: {}", (src / files[i]).c_str(), std::strerror(errno));
+        return;
+      }
+      identities[i] = identity_of(st);
+    });
+  }
+  pool.wait();
+  for (size_t i = 0; i < files.size(); i++) {
+    if (identities[i]) {
+      listed.files.emplace(std::move(files[i]), *identities[i]);
+    }
+  }
+
+  // Anything in dst that we did not stage from src is stale, and a staged file only counts as present if it is still
+  // exactly the copy we left there
+  std::vector<std::filesystem::path> stale{};
+  std::vector<std::filesystem::path> stale_directories{};
+  std::unordered_set<std::string> present{};
+  std::filesystem::recursive_directory_iterator dst_iter(dst, error_code);
+  if (error_code) {
+    LOG_ERROR("Failed to iterate destination directory: {}: {}", dst.c_str(), error_code.message().c_str());
+    return false;
+  }
+  for (auto const& entry : dst_iter) {
+    auto relative = entry.path().lexically_relative(dst).string();
+    if (entry.is_directory(error_code)) {
+      if (!listed.directories.contains(relative)) {
+        stale_directories.push_back(entry.path());
+      }
+      continue;
+    }
+    if (!listed.files.contains(relative) || excluded.contains(relative)) {
+      stale.push_back(entry.path());
+      continue;
+    }
+    auto it = manifest.files.find(relative);
+    struct stat64 st {};
+    if (it != manifest.files.end() && stat64(entry.path().c_str(), &st) == 0 &&
+        it->second.same_staged(identity_of(st))) {
+      present.emplace(std::move(relative));
+    }
+  }
+
+  for (auto const& path : stale) {
+    LOG_DEBUG("Removing stale staged file: {}", path.c_str());
+    if (!std::filesystem::remove(path, error_code) || error_code) {
+      LOG_ERROR("Failed to remove stale staged file: {}: {}", path.c_str(), error_code.message().c_str());
+      return false;
+    }
+    stats.removed++;
+  }
+  // Deepest first, so that each directory is empty by the time it is removed
+  std::sort(stale_directories.begin(), stale_directories.end(),
+            [](auto const& a, auto const& b) { return a.native().size() > b.native().size(); });
+  for (auto const& path : stale_directories) {
+    LOG_DEBUG("Removing stale staged directory: {}", path.c_str());
+    if (!std::filesystem::remove(path, error_code) || error_code) {
+      LOG_WARN("Failed to remove stale staged directory: {}: {}", path.c_str(), error_code.message().c_str());
+    }
+  }
+
+  for (auto const& [directory, identity] : listed.directories) {
+    if (directory.empty()) {
+      continue;
+    }
+    std::filesystem::create_directories(dst / directory, error_code);
+    if (error_code) {
+      LOG_ERROR("Failed to create directory: {}: {}", (dst / directory).c_str(), error_code.message().c_str());
+      return false;
+    }
+  }
+
+  StrategySupport support{};
+
+  // Each pending copy is written by exactly one worker, so no locking is needed until we merge them back in
+  struct PendingCopy {
+    std::string const* relative;
+    FileRecord record;
+    Strategy strategy;
+    bool success;
+  };
+  std::vector<PendingCopy> pending{};
+  for (auto& [relative, identity] : listed.files) {
+    // Excluded files are only listed, so that their directory need not be read again
+    if (excluded.contains(relative)) {
+      continue;
+    }
+    auto it = manifest.files.find(relative);
+    if (it != manifest.files.end() && it->second.same_identity(identity) && present.contains(relative)) {
+      identity = it->second;
+      stats.unchanged++;
+      continue;
+    }
+    pending.push_back(PendingCopy{ .relative = &relative, .record = {}, .strategy = Strategy::Copy, .success = false });
+  }
+  for (auto& copy : pending) {
+    pool.submit([&copy, &src, &dst, &support] {
+      LOG_DEBUG("Staging changed file: {}", (src / *copy.relative).c_str());
+      copy.success = copy_file(src / *copy.relative, dst / *copy.relative, support, copy.record, copy.strategy);
+    });
+  }
+  pool.wait();
+
+  // Sync each directory that was renamed into once, before the manifest claims the copies in it
+  std::unordered_map<std::string, bool> synced{};
+  for (auto& copy : pending) {
+    if (copy.success) {
+      auto [it, inserted] = synced.try_emplace((dst / *copy.relative).parent_path().string(), true);
+      if (inserted) {
+        it->second = sync_directory(it->first);
+      }
+      copy.success = it->second;
+    }
+  }
+
+  bool success = true;
+  for (auto& copy : pending) {
+    auto previous = manifest.files.find(*copy.relative);
+    // Restaged without the source changing, which earlier hashed bytes still describe
+    bool same_source = copy.success && previous != manifest.files.end() && previous->second.hash != 0 &&
+                       previous->second.same_identity(copy.record);
+    if (same_source && copy.record.hash != 0 && copy.record.hash != previous->second.hash) {
+      // One of the two passes read torn bytes, and there is no telling which
+      LOG_ERROR("Staged copy of: {} hashes to: {:016x} but was staged with: {:016x}", (src / *copy.relative).c_str(),
+                copy.record.hash, previous->second.hash);
+      if (!std::filesystem::remove(dst / *copy.relative, error_code) || error_code) {
+        LOG_WARN("Failed to remove mismatched staged copy: {}: {}", (dst / *copy.relative).c_str(),
+                 error_code.message().c_str());
+      }
+      copy.success = false;
+    }
+    if (!copy.success) {
+      // Listed without a staged copy, so that the next launch tries again
+      success = false;
+      continue;
+    }
+    if (same_source && copy.strategy == Strategy::Reflink) {
+      copy.record.hash = previous->second.hash;
+    }
+    listed.files.insert_or_assign(*copy.relative, copy.record);
+    switch (copy.strategy) {
+      case Strategy::Reflink:
+        stats.reflinked++;
+        break;
+      case Strategy::Copy:
+        stats.copied++;
+        stats.bytes += copy.record.size;
+        break;
+      case Strategy::Memfd:
+        stats.memfd++;
+        break;
+    }
+  }
+  manifest = std::move(listed);
+  stats.elapsed = std::chrono::steady_clock::now() - start;
+
+  auto& hashes = staged_hashes();
+  for (auto const& [relative, record] : manifest.files) {
+    if (record.hash != 0 && record.stagedInode != 0) {
+      FileRecord staged{ .size = record.stagedSize, .mtime = record.stagedMtime, .inode = record.stagedInode };
+      hashes.insert_or_assign((dst / relative).string(), StagedHash{ record.hash, staged, false });
+    }
+  }
+
+  if (success && stats.staged() == 0 && stats.removed == 0) {
+    LOG_INFO("Source directory: {} is unchanged, skipped staging {} files", src.c_str(), stats.unchanged);
+  }
+  return success;
+}
+
+bool stage_phase_memfd(std::filesystem::path const& src, std::filesystem::path const& dst,
+                       modloader::ThreadPool& pool, PhaseStats& stats, Exclusions const& excluded) noexcept {
+  auto start = std::chrono::steady_clock::now();
+  stats = PhaseStats{};
+  memfd_staging_used = true;
+  std::error_code error_code;
+  std::vector<std::filesystem::path> relatives{};
+  std::filesystem::recursive_directory_iterator src_iter(src, error_code);
+  if (error_code) {
+    LOG_ERROR("Failed to iterate source directory: {}: {}", src.c_str(), error_code.message().c_str());
+    return false;
+  }
+  for (auto const& entry : src_iter) {
+    // Nothing but shared objects can be loaded from a memfd, their policy files are read from one too
+    auto const& extension = entry.path().extension();
+    if (entry.is_directory(error_code) || (extension != ".so" && extension != modloader::kPolicySuffix)) {
+      continue;
+    }
+    auto relative = entry.path().lexically_relative(src);
+    if (excluded.contains(relative.string())) {
+      continue;
+    }
+    relatives.push_back(std::move(relative));
+  }
+
+  std::vector<std::optional<MemfdObject>> objects(relatives.size());
+  for (size_t i = 0; i < relatives.size(); i++) {
+    pool.submit([&objects, &relatives, &src, i] {
+      LOG_DEBUG("Staging into memfd: {}", (src / relatives[i]).c_str());
+      objects[i] = stream_to_memfd(src / relatives[i]);
+    });
+  }
+  pool.wait();
+
+  bool success = true;
+  auto& registered = memfd_objects();
+  for (size_t i = 0; i < relatives.size(); i++) {
+    if (!objects[i]) {
+      success = false;
+      continue;
+    }
+    struct stat64 st {};
+    if (fstat64(objects[i]->fd, &st) == 0) {
+      stats.bytes += st.st_size;
+    }
+    registered.insert_or_assign((dst / relatives[i]).string(), std::move(*objects[i]));
+    stats.memfd++;
+  }
+  stats.elapsed = std::chrono::steady_clock::now() - start;
+  return success;
+}
+
+bool memfd_staged() noexcept {
+  return memfd_staging_used;
+}
+
+MemfdObject const* find_memfd(std::filesystem::path const& path) noexcept {
+  if (!memfd_staging_used) {
+    return nullptr;
+  }
+  auto const& objects = memfd_objects();
+  auto it = objects.find(path.string());
+  return it != objects.end() ? &it->second : nullptr;
+}
+
+std::optional<uint64_t> content_hash_of(std::filesystem::path const& path) noexcept {
+  if (auto const* memfd = find_memfd(path)) {
+    if (memfd->hash == 0) {
+      return std::nullopt;
+    }
+    return memfd->hash;
+  }
+  auto const& hashes = staged_hashes();
+  auto it = hashes.find(path.string());
+  if (it == hashes.end()) {
+    return std::nullopt;
+  }
+  return it->second.hash;
+}
+
+std::optional<uint64_t> verified_hash_of(std::filesystem::path const& path) noexcept {
+  if (find_memfd(path) != nullptr) {
+    return content_hash_of(path);
+  }
+  auto const& hashes = staged_hashes();
+  auto it = hashes.find(path.string());
+  if (it == hashes.end() || !it->second.verified) {
+    return std::nullopt;
+  }
+  return it->second.hash;
+}
+
+bool verify_staged(std::filesystem::path const& path) noexcept {
+  // Sealed memfds cannot have changed since we wrote them
+  if (!modloader::get_config().contentHashing || find_memfd(path) != nullptr) {
+    return true;
+  }
+  auto& hashes = staged_hashes();
+  auto it = hashes.find(path.string());
+  if (it == hashes.end() || it->second.verified) {
+    return true;
+  }
+  // The hash was taken in the pass that wrote the staged copy, which it describes for as long as the copy is unchanged
+  struct stat64 st {};
+  if (stat64(path.c_str(), &st) != 0) {
+    LOG_ERROR("Failed to stat: {} for verification: {}", path.c_str(), std::strerror(errno));
+    return false;
+  }
+  if (!it->second.staged.same_identity(identity_of(st))) {
+    LOG_ERROR("Staged object: {} changed after it was staged with hash: {:016x}", path.c_str(), it->second.hash);
+    // Remove the changed copy, so that the next launch sees it as missing and stages it again
+    if (unlink(path.c_str()) != 0) {
+      LOG_WARN("Failed to remove mismatched staged object: {}: {}", path.c_str(), std::strerror(errno));
+    }
+    return false;
+  }
+  it->second.verified = true;
+  return true;
+}
+
+std::vector<std::filesystem::path> list_memfds(std::filesystem::path const& dir) noexcept {
+  std::vector<std::filesystem::path> paths{};
+  for (auto const& [path, object] : memfd_objects()) {
+    std::filesystem::path candidate(path);
+    if (candidate.parent_path() == dir) {
+      paths.push_back(std::move(candidate));
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+}  // namespace staging
@@ -0,0 +1,92 @@
+#include "string-interner.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+namespace modloader {
+
+namespace {
+
+constexpr StringId kEmpty = ~StringId{};
+constexpr size_t kMinCapacity = 64;
+
+}  // namespace
+
+StringId StringInterner::intern(std::string_view value) {
+  auto hash = std::hash<std::string_view>{}(value);
+  {
+    std::shared_lock lock(mutex);
+    if (!table.empty()) {
+      auto slot = locate(value, hash);
+      if (table[slot] != kEmpty) {
+        return table[slot];
+      }
+    }
+  }
+  std::unique_lock lock(mutex);
+  // Kept at most half full, so probe sequences stay short
+  if ((strings.size() + 1) * 2 > table.size()) {
+    grow();
+  }
+  // Another thread may have interned it in the meantime
+  auto slot = locate(value, hash);
+  if (table[slot] == kEmpty) {
+    table[slot] = static_cast<StringId>(strings.size());
+    strings.emplace_back(value);
+    hashes.push_back(hash);
+  }
+  return table[slot];
+}
+
+std::optional<StringId> StringInterner::find(std::string_view value) const noexcept {
+  auto hash = std::hash<std::string_view>{}(value);
+  std::shared_lock lock(mutex);
+  if (table.empty()) {
+    return std::nullopt;
+  }
+  auto slot = locate(value, hash);
+  if (table[slot] == kEmpty) {
+    return std::nullopt;
+  }
+  return table[slot];
+}
+
+std::string_view StringInterner::view(StringId id) const noexcept {
+  std::shared_lock lock(mutex);
+  return strings[id];
+}
+
+size_t StringInterner::size() const noexcept {
+  std::shared_lock lock(mutex);
+  return strings.size();
+}
+
+size_t StringInterner::locate(std::string_view value, size_t hash) const noexcept {
+  auto mask = table.size() - 1;
+  auto slot = hash & mask;
+  while (table[slot] != kEmpty && (hashes[table[slot]] != hash || strings[table[slot]] != value)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void StringInterner::grow() {
+  auto capacity = std::max(table.size() * 2, kMinCapacity);
+  table.assign(capacity, kEmpty);
+  auto mask = capacity - 1;
+  for (StringId id = 0; id < strings.size(); id++) {
+    auto slot = hashes[id] & mask;
+    while (table[slot] != kEmpty) {
+      slot = (slot + 1) & mask;
+    }
+    table[slot] = id;
+  }
+}
+
+StringInterner& get_interner() noexcept {
+  static StringInterner interner{};
+  return interner;
+}
+
+}  // namespace modloader
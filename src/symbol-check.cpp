@@ -0,0 +1,117 @@
+#include "symbol-check.hpp"
+#include "elf-image.hpp"
+#include "log.h"
+
+#include <dlfcn.h>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace modloader {
+
+SymbolChecker::~SymbolChecker() {
+  handles.for_each([](StringId, void* handle) {
+    if (handle != nullptr) {
+      dlclose(handle);
+    }
+  });
+}
+
+elf_utils::SymbolTable const* SymbolChecker::tableOf(StringId id, std::filesystem::path const& path) {
+  if (auto const* found = tables.find(id)) {
+    return found->get();
+  }
+  std::unique_ptr<elf_utils::SymbolTable> table{};
+  // Usually still mapped from when the object was scanned, so this reads no file
+  auto image = ElfImage::open(path);
+  if (image == nullptr) {
+    LOG_WARN("Failed to map: {} to read its symbols", path.c_str());
+  } else if (auto reader = image->dynamic()) {
+    if (auto read = reader->symbolTable()) {
+      table = std::make_unique<elf_utils::SymbolTable>(std::move(*read));
+    }
+  }
+  return tables.try_emplace(id, std::move(table)).first->get();
+}
+
+void* SymbolChecker::handleOf(StringId id, std::filesystem::path const& name) {
+  if (auto const* found = handles.find(id)) {
+    return *found;
+  }
+  // Only ever takes another reference on a library that is already loaded, nothing new is mapped
+  auto* handle = dlopen(name.c_str(), RTLD_NOLOAD | RTLD_LAZY);
+  dlerror();  // consume possible error
+  return *handles.try_emplace(id, handle).first;
+}
+
+std::optional<std::vector<std::string>> SymbolChecker::missingSymbols(DependencyGraph const& graph,
+                                                                      DependencyGraph::NodeId id) {
+  auto const* own = tableOf(graph.pathId(id), graph.path(id));
+  if (own == nullptr) {
+    return std::nullopt;
+  }
+  auto required = own->required();
+  if (required.empty()) {
+    return std::vector<std::string>{};
+  }
+
+  // The local group the linker searches: dependencies breadth first, each once
+  std::vector<elf_utils::SymbolTable const*> providers{};
+  std::vector<void*> loaded{};
+  std::vector<bool> seen(graph.size(), false);
+  std::vector<DependencyGraph::NodeId> queue{ id };
+  seen[id] = true;
+  for (size_t i = 0; i < queue.size(); i++) {
+    for (auto dep : graph.dependencies(queue[i])) {
+      if (seen[dep]) {
+        continue;
+      }
+      seen[dep] = true;
+      if (graph.missing(dep)) {
+        // Not one of ours, so it has to be a system library that is already loaded for it to be checked
+        auto* handle = handleOf(graph.pathId(dep), graph.path(dep));
+        if (handle == nullptr) {
+          LOG_DEBUG("Not checking symbols of: {}, its dependency: {} is not loaded yet", graph.path(id).c_str(),
+                    graph.path(dep).c_str());
+          return std::nullopt;
+        }
+        loaded.push_back(handle);
+        continue;
+      }
+      auto const* table = tableOf(graph.pathId(dep), graph.path(dep));
+      if (table == nullptr) {
+        return std::nullopt;
+      }
+      providers.push_back(table);
+      queue.push_back(dep);
+    }
+  }
+
+  std::vector<std::string> missing{};
+  for (auto [symbol, version] : required) {
+    // Our own objects are matched by name alone, which at worst lets through an object that fails to open
+    bool defined = std::any_of(providers.begin(), providers.end(),
+                               [symbol](auto const* table) { return table->defines(symbol); });
+    if (defined) {
+      continue;
+    }
+    // Loaded libraries and the global group can only be searched through dlsym, which needs terminated strings. A
+    // plain dlsym only finds default versions, so a symbol required at an older version is looked up at that version.
+    std::string name(symbol);
+    std::string versionName(version);
+    auto finds = [&](void* handle) {
+      return (version.empty() ? dlsym(handle, name.c_str()) : dlvsym(handle, name.c_str(), versionName.c_str())) !=
+             nullptr;
+    };
+    // The object is opened into the namespace of the loader, so RTLD_DEFAULT is the global group the linker searches
+    // before the dependencies: the executable, preloaded libraries and everything opened with RTLD_GLOBAL
+    defined = finds(RTLD_DEFAULT) || std::any_of(loaded.begin(), loaded.end(), finds);
+    if (!defined) {
+      missing.push_back(version.empty() ? std::move(name) : name + "@" + versionName);
+    }
+  }
+  dlerror();  // consume possible error
+  return missing;
+}
+
+}  // namespace modloader
@@ -0,0 +1,77 @@
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace modloader {
+
+ThreadPool::ThreadPool(size_t count) {
+  count = std::max<size_t>(count, 1);
+  workers.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    workers.emplace_back([this] { run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock lock(mutex);
+    idle.wait(lock, [this] { return tasks.empty() && active == 0; });
+    stopping = true;
+  }
+  task_available.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard lock(mutex);
+    tasks.emplace_back(std::move(task));
+  }
+  task_available.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock lock(mutex);
+  idle.wait(lock, [this] { return tasks.empty() && active == 0; });
+}
+
+size_t ThreadPool::default_size() noexcept {
+  // Leave the game's own threads some room, past this point we are limited by storage anyways
+  constexpr static size_t kMaxWorkers = 4;
+  return std::clamp<size_t>(std::thread::hardware_concurrency(), 1, kMaxWorkers);
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool pool(default_size());
+  return pool;
+}
+
+void ThreadPool::run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(mutex);
+      task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        // Only possible when stopping
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+      active++;
+    }
+    task();
+    {
+      std::lock_guard lock(mutex);
+      active--;
+      if (tasks.empty() && active == 0) {
+        idle.notify_all();
+      }
+    }
+  }
+}
+
+}  // namespace modloader
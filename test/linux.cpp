@@ -13,6 +13,27 @@ int main() {
   tests::sortDependencyTreeTest(deps);
 
   // tests::loadModsTest(dependencyPath);
+
+  bool passed = true;
+  passed &= tests::malformedElfTest();
+  passed &= tests::dependencyCycleTest();
+  passed &= tests::namesObjectTest();
+  passed &= tests::dependencyGraphTest(dependencyPath);
+  passed &= tests::manifestTest();
+  passed &= tests::contentHashTest();
+  passed &= tests::failureCacheTest();
+  passed &= tests::configTest();
+  passed &= tests::policyTest();
+  passed &= tests::stagedHashTest();
+  passed &= tests::stagePhaseTest();
+  passed &= tests::directoryIndexTest();
+  passed &= tests::prefetcherTest(dependencyPath);
+  passed &= tests::scheduleTest(dependencyPath);
+  passed &= tests::symbolCheckTest();
+  passed &= tests::elfMetadataCacheTest();
+  // Staging into memfds makes the loader look objects up in memfds for the rest of the process
+  passed &= tests::memfdStagingTest();
+  return passed ? 0 : 1;
 }
 
 #endif
\ No newline at end of file
@@ -9,4 +9,80 @@ void loadModsTest(const std::filesystem::path& path);
 std::vector<modloader::DependencyResult> getDependencyTreeTest(const std::filesystem::path& dependencyPath,
                                                                std::filesystem::path modPath);
 void sortDependencyTreeTest(std::span<modloader::DependencyResult const> dependencies);
+
+/// @brief Checks that ELF files with out of range hash table headers are rejected instead of read
+/// @return true if every check passed
+bool malformedElfTest();
+
+/// @brief Checks that dependency cycles are reported and that sorting still places every object once
+/// @return true if every check passed
+bool dependencyCycleTest();
+
+/// @brief Checks which names and mod ids refer to an object, as used to find deferred mods
+/// @return true if every check passed
+bool namesObjectTest();
+
+/// @brief Checks that the load order and plan of a dependency graph match topologicalSort of the dependency trees of
+/// every object in dependencyPath
+/// @return true if every check passed
+bool dependencyGraphTest(std::filesystem::path const& dependencyPath);
+
+/// @brief Checks that staging manifests, including escaped names, read back as they were written
+/// @return true if every check passed
+bool manifestTest();
+
+/// @brief Checks that hashing bytes in chunks of any size gives the same hash as hashing them in one go
+/// @return true if every check passed
+bool contentHashTest();
+
+/// @brief Checks that failure keys change with the files they were built from, and that failures persist under them
+/// @return true if every check passed
+bool failureCacheTest();
+
+/// @brief Checks that the loader config is parsed, that a missing one reads as the defaults and that malformed values
+/// are ignored
+/// @return true if every check passed
+bool configTest();
+
+/// @brief Checks that policy files are parsed and that malformed values are ignored
+/// @return true if every check passed
+bool policyTest();
+
+/// @brief Checks that staged objects are hashed by the pass that copies them, that a copy which does not match the
+/// hash its unchanged source was staged with fails, and that objects changed after staging fail verification
+/// @return true if every check passed
+bool stagedHashTest();
+
+/// @brief Checks that staging copies only added, modified and changed files, removes stale ones and skips a phase
+/// that did not change, against a temp tree
+/// @return true if every check passed
+bool stagePhaseTest();
+
+/// @brief Checks that objects and policy files are staged into sealed memfds holding their bytes, and are found and
+/// opened through the paths they would have been staged to
+/// @return true if every check passed
+bool memfdStagingTest();
+
+/// @brief Checks that the directory index resolves names in the same order as the exists lookups it replaced, and is
+/// built again once invalidated
+/// @return true if every check passed
+bool directoryIndexTest();
+
+/// @brief Checks that the prefetcher reads ahead no further than its budget, and that opening objects moves it on
+/// @return true if every check passed
+bool prefetcherTest(std::filesystem::path const& dependencyPath);
+
+/// @brief Checks that setups run after the setups of the mods they depend on, and that workers hand the setups of mods
+/// that are not thread safe to the calling thread
+/// @return true if every check passed
+bool scheduleTest(std::filesystem::path const& dependencyPath);
+
+/// @brief Checks that the symbol checker fails an object with the symbols nothing defines, and only such objects
+/// @return true if every check passed
+bool symbolCheckTest();
+
+/// @brief Checks that the ELF metadata cache reads back objects and needed names holding tabs, newlines and
+/// backslashes
+/// @return true if every check passed
+bool elfMetadataCacheTest();
 }  // namespace tests